@@ -3,14 +3,32 @@
 /*
 ECE342 Lab6 Assembler
 command line argument: optional DEPTH (number of words in total); optional inputFileName
-encoding is hardcoded according to lab6 document; IR is assumed to use upper 9 bits from DIN
+	-c: write object file (.obj) instead of mif
+	-l obj1 obj2 ...: link object files into one mif
+	-o fileName: specify output fileName
+	-disasm file.mif [-sym symbolFile]: convert mif back to source
+	-list: also write listing with cross reference (<output>.lst)
+	-symtab: write constants and labels at beginning of mif
+	-delta previousImage: also write changed words only (<output>.patch.mif and <output>.patch.bin)
+	-diag text|json|sarif: format of errors and warnings
+	-diagmax N: number of distinct messages shown for each category
+	-pipe: read source and write output in separate threads
+	-stats: report allocations of symbols, relocations and comments
+	-isa name: instruction set variant (see ISA_TABLE)
+	-cache dir: reuse output of identical source and options from previous runs
+encoding is described by ISA_TABLE (lab6 document by default); IR is assumed to use upper bits from DIN
 
 Features:
 	able to define constants using "#define name value"
-	able to hardcode data using "#data value"
+	able to hardcode data using "#data value" (or "#data value1,value2,...")
+	able to hardcode bulk data using "#fill count,value", "#string \"text\"" and "#incbin fileName[,offset,length]"
 	support single line comments (starting with "//")
 	support for labels (value is the address of next instructions/data)
 	support addition and subtraction (EDIT: arithmetic expressions (+,-,*,/,paranthesis) when evaluating expressions
+		EDIT: immediates can use several labels (e.g. "END-START"); they are evaluated when labels are resolved
+	preprocessor: "#include file", parameterized macros ("#macro name params" ... "#endmacro"),
+		conditional assembly ("#if expr", "#ifdef name", "#ifndef name", "#elif expr", "#else", "#endif")
+	separate memories using "#bank name base depth [width]" (each written to <output>.<name>.mif)
 
 Note:
 	1.	This program reads from stdin and write mif to stdout. Errors or other information goes to stderr.
@@ -23,6 +41,9 @@ Note:
 		e.g.	#define ROM_ADDRESS 0xf000
 				LABEL_START:
 				mvi pc, LABEL_START+ROM_ADDRESS
+		EDIT: or put the code in "#bank ROM 0xf000 depth"; labels in a bank are at its base address.
+			"#bank name" continues a bank defined before and "#bank" alone goes back to the main output.
+			Listing and patch output cover the main output only; banks are not supported in object files.
 				
 	3.	NO LONGER TRUE!!! Please do not put whitespace inside one expression; everything after the third field will be discarded
 		e.g.	don't write: "mvi R0, Constant1+ Constant2", which becomes "mvi R0, Constant1+" and gives you error
@@ -32,15 +53,28 @@ Note:
 	4.	All ',' will be substituted by whitespace before analyzing the instruction.
 		You can use comma or any whitespace to split fields
 	
-	5.	Compile using at least C++11
+	5.	Compile using at least C++11 (add -pthread for gcc / clang on Linux)
 	
 	6.	Please prevent constants and labels having the same name.
 		If it happens, then if the constant is defined before using it, evaluation treat it as constant,
 			otherwise it is treated as a label
 		Constants cannot have same name, and same to labels (treated as error).
 		You can have multiple labels labeling the same address.
+		EDIT: constants can be used before they are defined. "#define" using constants defined later is
+			evaluated when first needed (or at the end of the first pass) after the constants it depends on;
+			circular definitions are errors. Names used before definition that are not labels then take the value of the constant.
+		EDIT: constants using labels are substituted into immediates using them (not usable by "#if" or "#fill" count).
 	
-	6.	Please forgive for misuse of variable names...
+	7.	Included files are read once and cached; use "#ifndef NAME" / "#define NAME" / "#endif" as include guard.
+		Relative paths in "#include" are relative to the directory of the file containing the directive.
+		Macro arguments are separated by ','. Parameters are substituted by whole identifiers only.
+		"\@" in a macro body is replaced by a number unique to each expansion (useful for labels inside macros).
+		"#if", "#elif", "#fill" count and "#incbin" offset / length can only use constants whose value is known at that line.
+	
+	8.	When linking, modules are placed in the order given on command line.
+		Labels are only visible in the module defining them unless they are listed in "#export".
+	
+	9.	Please forgive for misuse of variable names...
 	
 */
 
@@ -57,12 +91,15 @@ Note:
 #define INSTR_DEFINE_CONSTANT_STR "#define"
 #endif
 
-//output all constants and labels at beginning of mif file
+//output all constants and labels at beginning of mif file by default (otherwise use -symtab)
 //#define OUTPUT_WRITE_SYMBOL_TABLE
 
 //explicitly zero fill the rest of memory
 #define OUTPUT_ZERO_FILL
 
+//write runs of identical words without comment (e.g. from #fill) as one [begin..end] entry
+#define OUTPUT_MERGE_REPEATED_WORDS
+
 //includes
 #include <iostream>
 #include <iomanip>
@@ -70,11 +107,42 @@ Note:
 #include <sstream>
 #include <fstream>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <locale>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include <new>
+#include <cstdio>
+#include <chrono>
 
-#ifdef OUTPUT_WRITE_SYMBOL_TABLE
-#include <map>
+//vectorized line scanning; define SCAN_NO_SIMD to use the scalar version only
+#ifndef SCAN_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_USE_AVX2
+#elif defined(__SSE2__)||defined(_M_X64)||(defined(_M_IX86_FP)&&(_M_IX86_FP>=2))
+#include <emmintrin.h>
+#define SCAN_USE_SSE2
+#endif
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//process id for names of temporary files
+#ifdef _WIN32
+#include <process.h>
+#define PROCESS_ID() _getpid()
+#else
+#include <unistd.h>
+#define PROCESS_ID() getpid()
 #endif
 
 //constants
@@ -83,46 +151,153 @@ const std::string WHITESPACE=" \t";
 using content_type=unsigned;
 using offset_type=int;
 
-constexpr content_type INSTR_MV		=0;
-constexpr content_type INSTR_MVI	=1;
-constexpr content_type INSTR_ADD	=2;
-constexpr content_type INSTR_SUB	=3;
-constexpr content_type INSTR_LD		=4;
-constexpr content_type INSTR_ST		=5;
-constexpr content_type INSTR_MVNZ	=6;
+//kinds of instructions (operands they take); codes from INSTR_DATA are directives
+constexpr content_type INSTR_REG_REG	=0;//rx, ry
+constexpr content_type INSTR_REG_IMM	=1;//rx, immediate in next word
 
 constexpr content_type INSTR_DATA	=8;//used to hardcode data in ROM
+constexpr content_type INSTR_FILL	=9;//repeat one value
+constexpr content_type INSTR_STRING	=10;//pack characters into words
+constexpr content_type INSTR_INCBIN	=11;//pack content of a binary file into words
+
+//instruction set description
+struct InstructionDesc{
+	const char* mnemonic;
+	content_type opcode;
+	content_type kind;//INSTR_REG_REG or INSTR_REG_IMM
+};
+
+struct IsaDesc;
+using InstructionEncoder=unsigned long long(*)(const IsaDesc& isa, content_type opcode, content_type rx, content_type ry, unsigned rightPadding);
+
+//one variant of the processor
+//IR is opcode, rx and ry from the most significant bit, followed by __IROffset__ zero bits
+struct IsaDesc{
+	const char* name;
+	unsigned opcodeBits;
+	unsigned registerBits;//registers are r0, r1, ...; pc is the last one
+	const InstructionDesc* instructions;
+	std::size_t instructionCount;
+	InstructionEncoder encoder;//nullptr: use encodeByTable()
+	
+	constexpr unsigned irBits()const{
+		return opcodeBits+2*registerBits;
+	}
+};
+
+//encoder with field widths fixed at compile time
+template<unsigned OpcodeBits, unsigned RegisterBits>
+unsigned long long encodeFixed(const IsaDesc&, content_type opcode, content_type rx, content_type ry, unsigned rightPadding){
+	static_assert(OpcodeBits+2*RegisterBits<=32,"IR does not fit in content_type");
+	return static_cast<unsigned long long>((opcode<<(2*RegisterBits))|(rx<<RegisterBits)|ry)<<rightPadding;
+}
+
+//encoder reading field widths from the table (for variants without a specialized encoder)
+unsigned long long encodeByTable(const IsaDesc& isa, content_type opcode, content_type rx, content_type ry, unsigned rightPadding){
+	return static_cast<unsigned long long>((opcode<<(2*isa.registerBits))|(rx<<isa.registerBits)|ry)<<rightPadding;
+}
+
+//encoding is according to lab6 document
+const InstructionDesc LAB6_INSTRUCTIONS[]={
+		{"mv",		0,	INSTR_REG_REG},
+		{"mvi",		1,	INSTR_REG_IMM},
+		{"add",		2,	INSTR_REG_REG},
+		{"sub",		3,	INSTR_REG_REG},
+		{"ld",		4,	INSTR_REG_REG},
+		{"st",		5,	INSTR_REG_REG},
+		{"mvnz",	6,	INSTR_REG_REG}
+};
+
+//selected by "#define __ISA__ index" or -isa name; add a row (and instruction table) for a new variant
+const IsaDesc ISA_TABLE[]={
+		{"lab6",	3,	3,	LAB6_INSTRUCTIONS,	sizeof(LAB6_INSTRUCTIONS)/sizeof(InstructionDesc),	&encodeFixed<3,3>},
+		{"lab6r16",	3,	4,	LAB6_INSTRUCTIONS,	sizeof(LAB6_INSTRUCTIONS)/sizeof(InstructionDesc),	&encodeFixed<3,4>}//16 registers
+};
+constexpr std::size_t ISA_COUNT=sizeof(ISA_TABLE)/sizeof(IsaDesc);
 
-//they are not constants any more..
-unsigned OFFSET_RIGHT_PADDING	=7;
-unsigned OFFSET_OPCODE			=OFFSET_RIGHT_PADDING+6;
-unsigned OFFSET_RX				=OFFSET_RIGHT_PADDING+3;
-unsigned OFFSET_RY				=OFFSET_RIGHT_PADDING;
+//instruction set in use and position of IR in word
+struct EncodingState{
+	const IsaDesc* isa;
+	InstructionEncoder encoder;
+	unsigned rightPadding;//__IROffset__
+	std::unordered_map<std::string,const InstructionDesc*> instructionMap;
+	std::unordered_map<std::string,content_type> registerMap;
+	std::vector<const InstructionDesc*> opcodeTable;//by opcode; nullptr if not used
+	
+	EncodingState():isa(nullptr),encoder(nullptr),rightPadding(0){}
+	
+	void select(const IsaDesc& desc){
+		isa=&desc;
+		encoder=(desc.encoder!=nullptr)?desc.encoder:&encodeByTable;
+		instructionMap.clear();
+		opcodeTable.assign(std::size_t(1)<<desc.opcodeBits,nullptr);
+		for(std::size_t i=0;i<desc.instructionCount;++i){
+			instructionMap.insert(std::make_pair(std::string(desc.instructions[i].mnemonic),&(desc.instructions[i])));
+			opcodeTable[desc.instructions[i].opcode]=&(desc.instructions[i]);
+		}
+		registerMap.clear();
+		const content_type registerCount=1u<<desc.registerBits;
+		for(content_type i=0;i<registerCount;++i){
+			registerMap.insert(std::make_pair("r"+std::to_string(i),i));
+		}
+		registerMap.insert(std::make_pair(std::string("pc"),registerCount-1));
+	}
+	
+	unsigned long long encode(const InstructionDesc& instr, content_type rx, content_type ry)const{
+		return encoder(*isa,instr.opcode,rx,ry,rightPadding);
+	}
+}encoding;
 
 constexpr unsigned long long PADD_NOOP=0;
 
 const std::string INSTR_DEFINE_CONSTANT=INSTR_DEFINE_CONSTANT_STR;
 
-const std::unordered_map<std::string,content_type> OPCODE_MAP={
+//preprocessor directives
+const std::string DIRECTIVE_INCLUDE="#include";
+const std::string DIRECTIVE_MACRO="#macro";
+const std::string DIRECTIVE_ENDMACRO="#endmacro";
+const std::string DIRECTIVE_IF="#if";
+const std::string DIRECTIVE_IFDEF="#ifdef";
+const std::string DIRECTIVE_IFNDEF="#ifndef";
+const std::string DIRECTIVE_ELIF="#elif";
+const std::string DIRECTIVE_ELSE="#else";
+const std::string DIRECTIVE_ENDIF="#endif";
+
+//make labels visible to other modules when linking object files
+const std::string DIRECTIVE_EXPORT="#export";
+
+//separate memories written to their own mif
+const std::string DIRECTIVE_BANK="#bank";
+
+//diagnostics: messages of one category (e.g. "invalid-register") beyond this limit are only counted
+#ifndef DIAGNOSTIC_CATEGORY_LIMIT
+#define DIAGNOSTIC_CATEGORY_LIMIT 100
+#endif
+//diagnostics: places kept for each distinct message; repeats elsewhere are only counted
+#ifndef DIAGNOSTIC_SITE_LIMIT
+#define DIAGNOSTIC_SITE_LIMIT 100
+#endif
+
+constexpr unsigned DIAGNOSTIC_FORMAT_TEXT	=0;
+constexpr unsigned DIAGNOSTIC_FORMAT_JSON	=1;
+constexpr unsigned DIAGNOSTIC_FORMAT_SARIF	=2;
+
+//limit of nested #include and macro expansion (prevent infinite recursion)
+constexpr std::size_t MAX_INPUT_NESTING=64;
+
+//run arena: blocks of this size are bump allocated; requests larger than ARENA_LARGE_SIZE go to the heap
+constexpr std::size_t ARENA_CHUNK_SIZE=1<<20;
+constexpr std::size_t ARENA_LARGE_SIZE=1<<12;
+
+//pipelined mode (-pipe): size of each block passed between threads and number of blocks in flight
+constexpr std::size_t PIPE_BLOCK_SIZE=1<<18;
+constexpr std::size_t PIPE_QUEUE_LENGTH=16;
+
+const std::unordered_map<std::string,content_type> DIRECTIVE_MAP={
 		{"#data",INSTR_DATA},//use it if you want to hardcode something
-		{"mv",INSTR_MV},
-		{"mvi",INSTR_MVI},
-		{"add",INSTR_ADD},
-		{"sub",INSTR_SUB},
-		{"ld",INSTR_LD},
-		{"st",INSTR_ST},
-		{"mvnz",INSTR_MVNZ}
-};
-const std::unordered_map<std::string,content_type> registerMap={
-		{"r0",0},
-		{"r1",1},
-		{"r2",2},
-		{"r3",3},
-		{"r4",4},
-		{"r5",5},
-		{"r6",6},
-		{"r7",7},
-		{"pc",7}
+		{"#fill",INSTR_FILL},
+		{"#string",INSTR_STRING},
+		{"#incbin",INSTR_INCBIN}
 };
 
 //define these constants to overwrite options
@@ -132,90 +307,832 @@ const std::string OPTION_WIDTH="__WIDTH__";
 const std::string OPTION_IsByteAddressing="__IsByteAddressing__";
 const std::string OPTION_IsOffsetCorrectionNeeded="__IsOffsetCorrectionNeeded__";
 const std::string OPTION_IROffset="__IROffset__";
+const std::string OPTION_ISA="__ISA__";
 
 const std::vector<std::pair<std::string,content_type>> optionVec={//name, default value
 	{OPTION_DEPTH,128},//How many words in this memory
 	{OPTION_WIDTH,16},//how many bits in a word (assume it is the same for both memory and processor)
 	{OPTION_IsByteAddressing,0},//non_zero value: labels (but not offset) will be automatically multiplied by (__WIDTH__/8)
 	{OPTION_IsOffsetCorrectionNeeded,0},//non_zero value: offsets of labels will be automatically multiplied by (__WIDTH__/8). Disabled when __IsByteAddressing__ is zero.
-	{OPTION_IROffset,7}//will be adjusted to (__WIDTH__-9) when __WIDTH__ get changed (change this after __WIDTH__ if you are not using highest 9 bits for IR)
+	{OPTION_IROffset,7},//will be adjusted to (__WIDTH__-bits of IR) when __WIDTH__ or __ISA__ get changed (change this after them if you are not using highest bits for IR)
+	{OPTION_ISA,0}//index in ISA_TABLE
+};
+
+//monotonic allocator for data kept until exit: nodes of symbol tables (constants, labels, pending labels, symbolic constants, expression index),
+//relocations of each label, comments of each word and names of labels written to the mif
+//keys of the tables are std::string, so names longer than its small buffer, and vectors (words, expressions, source lines) stay on the heap
+//allocation is a pointer bump; nothing is freed before all chunks are released at exit
+//only used by the main thread
+class Arena{
+private:
+	std::vector<char*> chunks;
+	char* cursor;
+	char* limit;
+	
+public:
+	//reported by -stats
+	std::size_t allocationCount;
+	std::size_t allocationBytes;
+	std::size_t largeAllocationCount;//larger than ARENA_LARGE_SIZE, passed to heap
+	std::size_t largeAllocationBytes;
+	
+	Arena():cursor(nullptr),limit(nullptr),allocationCount(0),allocationBytes(0),largeAllocationCount(0),largeAllocationBytes(0){}
+	
+	~Arena(){
+		for(auto iter=chunks.begin();iter!=chunks.end();++iter){
+			std::free(*iter);
+		}
+	}
+	
+	void* allocate(std::size_t size, std::size_t alignment){
+		if(size>ARENA_LARGE_SIZE){
+			++largeAllocationCount;
+			largeAllocationBytes+=size;
+			return ::operator new(size);
+		}
+		++allocationCount;
+		allocationBytes+=size;
+		std::size_t padding=(cursor==nullptr)?0:((alignment-reinterpret_cast<std::size_t>(cursor)%alignment)%alignment);
+		if((cursor==nullptr)||(padding+size>static_cast<std::size_t>(limit-cursor))){
+			char* chunk=static_cast<char*>(std::malloc(ARENA_CHUNK_SIZE));
+			if(chunk==nullptr) throw std::bad_alloc();
+			chunks.push_back(chunk);
+			cursor=chunk;
+			limit=chunk+ARENA_CHUNK_SIZE;
+			padding=0;//malloc returns memory aligned for any type
+		}
+		void* result=cursor+padding;
+		cursor+=padding+size;
+		return result;
+	}
+	
+	void deallocate(void* ptr, std::size_t size){
+		if(size>ARENA_LARGE_SIZE) ::operator delete(ptr);
+	}
+	
+	std::size_t chunkCount()const{
+		return chunks.size();
+	}
+}runArena;//must be defined before containers using it
+
+template<typename T>
+struct ArenaAllocator{
+	using value_type=T;
+	
+	ArenaAllocator(){}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>&){}
+	
+	T* allocate(std::size_t n){
+		return static_cast<T*>(runArena.allocate(n*sizeof(T),alignof(T)));
+	}
+	
+	void deallocate(T* ptr, std::size_t n){
+		runArena.deallocate(ptr,n*sizeof(T));
+	}
 };
 
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&){
+	return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&){
+	return false;
+}
+
+using ArenaString=std::basic_string<char,std::char_traits<char>,ArenaAllocator<char>>;
+
+template<typename Value>
+using ArenaMap=std::unordered_map<std::string,Value,std::hash<std::string>,std::equal_to<std::string>,ArenaAllocator<std::pair<const std::string,Value>>>;
+
 //global variables
-std::unordered_map<
-		std::string,	//name of constant
+ArenaMap<
 		content_type	//value
-> constantMap;//put constants
+> constantMap;//put constants (by name)
 
-std::unordered_map<
-		std::string,	//name of label
+ArenaMap<
 		content_type	//value
-> labelMap;//put labels
+> labelMap;//put labels (by name)
 
 std::vector<unsigned long long> assembly;//store outputs
 
-std::vector<std::string> comment_code;//used to output source code as comment in mif
+std::vector<ArenaString> comment_code;//used to output source code as comment in mif
 
-std::vector<std::pair<std::string,content_type>> comment_label;//used to put label as comment in mif ([address,labelName])
+using LabelComments=std::vector<std::pair<ArenaString,content_type>>;
+LabelComments comment_label;//used to put label as comment in mif ([labelName,address])
 	
-std::unordered_map<
-		std::string,			//name of needed label
+using PendingLabelMap=ArenaMap<
 		std::vector<
 			std::pair<
 				content_type,	//where is the immediate need updating
 				offset_type		//the offset wrt label address
-			>
+			>,
+			ArenaAllocator<std::pair<content_type,offset_type>>
 		>
-> pendingLabelMap;//during the first pass, all dependency on labels will be stored here
+>;//by name of needed label
+PendingLabelMap pendingLabelMap;//during the first pass, all dependency on labels will be stored here
+
+//word holding the value of an expression that is more than label+offset (e.g. END-START); see relocatableExpressions
+struct ExpressionRelocation{
+	content_type address;
+	std::size_t expression;//index in relocatableExpressions
+};
+std::vector<ExpressionRelocation> expressionRelocations;
+
+//where a line of source comes from
+struct SourceLocation{
+	std::string fileName;//empty if it is stdin
+	unsigned line;
+	std::string expansionNote;//non-empty if the line comes from a macro expansion
+	
+	SourceLocation():line(0){}
+	
+	void print(std::ostream& dest)const{
+		if(fileName.empty()){
+			dest<<"line "<<std::to_string(line);
+		}else{
+			dest<<fileName<<':'<<std::to_string(line);
+		}
+		if(!(expansionNote.empty())) dest<<" ("<<expansionNote<<')';
+	}
+};
+
+//memory with its own image (#bank); labels in it are at base+index
+//content of the bank being assembled is in assembly, comment_code, comment_label, pendingLabelMap and expressionRelocations (see selectBank())
+struct Bank{
+	std::string name;//empty for the default bank (main output)
+	SourceLocation location;//#bank defining it
+	content_type base;
+	unsigned depth;
+	unsigned width;//may be too small for instructions (data only)
+	std::vector<unsigned long long> assembly;
+	std::vector<ArenaString> comment_code;
+	LabelComments comment_label;
+	PendingLabelMap pendingLabelMap;
+	std::vector<ExpressionRelocation> expressionRelocations;
+	
+	Bank():base(0),depth(0),width(0){}
+};
+std::vector<Bank> banks(1);//banks[0] is the default bank (base 0; __DEPTH__, __WIDTH__)
+std::size_t currentBank=0;
+
+//IR stays in the highest bits of the word (__IROffset__ in main memory)
+void updateRightPadding(){
+	if(currentBank==0){
+		encoding.rightPadding=constantMap.at(OPTION_IROffset);
+	}else{
+		//instructions are rejected in banks narrower than IR
+		const unsigned width=banks[currentBank].width;
+		encoding.rightPadding=(width>encoding.isa->irBits())?(width-encoding.isa->irBits()):0;
+	}
+}
+
+//make given bank the one being assembled
+void selectBank(std::size_t index){
+	if(index==currentBank) return;
+	Bank& previous=banks[currentBank];
+	previous.assembly.swap(assembly);
+	previous.comment_code.swap(comment_code);
+	previous.comment_label.swap(comment_label);
+	previous.pendingLabelMap.swap(pendingLabelMap);
+	previous.expressionRelocations.swap(expressionRelocations);
+	Bank& next=banks[index];
+	next.assembly.swap(assembly);
+	next.comment_code.swap(comment_code);
+	next.comment_label.swap(comment_label);
+	next.pendingLabelMap.swap(pendingLabelMap);
+	next.expressionRelocations.swap(expressionRelocations);
+	currentBank=index;
+	updateRightPadding();
+}
+
+//width of words being assembled
+unsigned currentWidth(){
+	return (currentBank==0)?constantMap.at(OPTION_WIDTH):banks[currentBank].width;
+}
+
+//depth of memory being assembled
+unsigned currentDepth(){
+	return (currentBank==0)?constantMap.at(OPTION_DEPTH):banks[currentBank].depth;
+}
+
+//bytes per word of the memory holding a (word) address: one of the named banks or main memory
+//with byte addressing, the byte address of a label is its word address times this
+unsigned long long bytesPerWordAt(unsigned long long address){
+	for(auto iter_bank=banks.begin()+1;iter_bank!=banks.end();++iter_bank){
+		if((address>=iter_bank->base)&&(address<iter_bank->base+iter_bank->depth)) return iter_bank->width/8;
+	}
+	return constantMap.at(OPTION_WIDTH)/8;
+}
+
+//true if (word or byte) address is in main memory of given depth or in one of the named banks
+bool isMappedAddress(unsigned long long address, unsigned long long mainDepth, bool isByteAddress){
+	if(address<mainDepth*(isByteAddress?(constantMap.at(OPTION_WIDTH)/8):1)) return true;
+	for(auto iter_bank=banks.begin()+1;iter_bank!=banks.end();++iter_bank){
+		const unsigned long long bytesPerAddress=isByteAddress?(iter_bank->width/8):1;
+		if((address>=iter_bank->base*bytesPerAddress)&&(address<(iter_bank->base+iter_bank->depth)*bytesPerAddress)) return true;
+	}
+	return false;
+}
+
+struct MacroDefinition{
+	std::vector<std::string> parameters;
+	std::shared_ptr<const std::vector<std::string>> body;
+	SourceLocation location;//where the first line of body is
+};
+
+std::unordered_set<std::string> exportSet;//labels declared by #export
+
+std::vector<std::string> sourceFiles;//paths read (or failed to read) by #include and #incbin; checked by build cache
+
+//command line options
+const std::string ARG_OBJECT="-c";//write object file instead of mif
+const std::string ARG_LINK="-l";//link object files into mif
+const std::string ARG_OUTPUT="-o";//specify output fileName
+const std::string ARG_DISASSEMBLE="-disasm";//convert mif back to source (written to stdout or -o)
+const std::string ARG_SYMBOL="-sym";//labels for disassembly from object file or mif
+const std::string ARG_LISTING="-list";//write listing with cross reference
+const std::string ARG_SYMBOL_TABLE="-symtab";//write constants and labels at beginning of mif
+const std::string ARG_DELTA="-delta";//write patch against given previous image
+const std::string ARG_DIAGNOSTIC_FORMAT="-diag";//text, json or sarif
+const std::string ARG_DIAGNOSTIC_LIMIT="-diagmax";//number of distinct messages shown for each category
+const std::string ARG_PIPELINE="-pipe";//read source and write output in separate threads
+const std::string ARG_STATS="-stats";//report allocations from run arena
+const std::string ARG_ISA="-isa";//default instruction set (name or index in ISA_TABLE)
+const std::string ARG_CACHE="-cache";//directory of persistent build cache
+
+struct RunOptions{
+	bool isObjectOutput;
+	bool isLinking;
+	std::string outputFileName;//empty if derived from input fileName
+	std::string deltaBaseFileName;//previous image (mif or binary); empty if no patch is needed
+	std::string outputBaseName;//output fileName without suffix; used for patch and listing
+	bool isDisassembling;
+	std::string symbolFileName;//labels used when disassembling
+	bool isListing;//write <outputBaseName>.lst
+	bool isPipelined;//reader and writer threads
+	bool isStatsShown;//report arena allocations as info
+	content_type isaIndex;//default of __ISA__
+	std::string cacheDirectory;//empty if build cache is not used
+	bool isSymbolTableWritten;//write constants and labels at beginning of mif
+	
+	RunOptions():
+			isObjectOutput(false),
+			isLinking(false),
+			isDisassembling(false),
+			isListing(false),
+			isPipelined(false),
+			isStatsShown(false),
+			isaIndex(0),
+#ifdef OUTPUT_WRITE_SYMBOL_TABLE
+			isSymbolTableWritten(true){
+#else
+			isSymbolTableWritten(false){
+#endif
+	}
+}runOptions;
+
+std::unordered_map<
+		std::string,	//name of macro
+		MacroDefinition
+> macroMap;//put macros
+
+//#define using names that are not constants yet; evaluated when used or at the end of the first pass
+struct DeferredConstant{
+	std::string expression;
+	SourceLocation location;
+	bool isEvaluating;//on current path in dependency graph; reaching it again means circular definition
+	bool isFailed;//error is already reported
+	unsigned failedGeneration;//constantGeneration when it could not be evaluated yet (zero if never)
+};
+
+std::unordered_map<
+		std::string,	//name of constant
+		DeferredConstant
+> deferredConstantMap;
+std::vector<std::string> deferredConstantOrder;//names in order of definition
+//a deferred constant that could not be evaluated is not walked again until a name it missed is defined
+unsigned constantGeneration=1;
+std::unordered_set<std::string> missingConstantNames;//names that are not constants (yet) used by deferred constants
+
+void noteConstantDefined(const std::string& name){
+	if(missingConstantNames.erase(name)!=0) ++constantGeneration;
+}
+
+//immediate using names that are not constants yet (later constants or labels); evaluated at the end of the first pass
+struct DeferredExpression{
+	std::string expression;
+	content_type address;
+	content_type count;//number of words having this value (#fill)
+	std::size_t bank;
+	SourceLocation location;
+};
+std::vector<DeferredExpression> deferredExpressions;
+
+//one line of listing; number of words is the difference to address of next line
+struct ListingLine{
+	content_type address;
+	SourceLocation location;
+	std::string text;
+};
+
+//only recorded when listing is needed
+struct CrossReference{
+	bool isRecording;//true when evaluating operands of instruction or data
+	content_type address;//word being encoded; recorded for constants used while isRecording
+	std::vector<ListingLine> lines;
+	std::unordered_map<
+			std::string,	//name of label or constant
+			SourceLocation	//where it is defined
+	> definitions;
+	std::unordered_map<
+			std::string,			//name of constant
+			std::vector<content_type>	//address of instruction or data using it
+	> constantUses;//uses of labels are in pendingLabelMap
+	
+	CrossReference():isRecording(false),address(0){}
+}crossReference;
+
+std::string getLowerCase(const std::string& str);
 
 class IOManager{
 private:
-	unsigned lineCount;
+	//one entry for the main source, each included file and each macro expansion
+	struct InputFrame{
+		std::istream* stream;//main source; nullptr if lines is used
+		std::shared_ptr<const std::vector<std::string>> lines;//cached file content or expanded macro body
+		std::size_t nextLine;
+		SourceLocation location;//location of the line last read
+	};
+	
+	std::vector<InputFrame> inputStack;
+	std::unordered_map<
+			std::string,	//path of file
+			std::shared_ptr<const std::vector<std::string>>	//content of file, one entry per line
+	> fileCache;//every file is read only once
+	SourceLocation lastLocation;//used after input is exhausted
 	unsigned warningCount;
 	unsigned errorCount;
+	
+	struct DiagnosticSite{
+		SourceLocation location;
+		unsigned column;//1-based; 0 if unknown
+	};
+	
+	//one entry for each distinct message; repeats increase count and add their place
+	struct Diagnostic{
+		const char* severity;
+		std::string code;
+		std::vector<DiagnosticSite> sites;//first DIAGNOSTIC_SITE_LIMIT places; empty if not about a line
+		std::string message;
+		unsigned count;
+	};
+	std::vector<Diagnostic> diagnostics;
+	std::unordered_map<
+			std::string,	//severity, code and message
+			std::size_t		//index in diagnostics; npos if suppressed by categoryLimit
+	> diagnosticIndex;
+	std::unordered_map<
+			std::string,	//code
+			unsigned		//number of distinct messages
+	> categoryCount;
+	std::ostringstream pendingMessage;//message being written by caller
+	bool isMessagePending;
+	const char* pendingSeverity;
+	std::string pendingCode;
+	bool isPendingLocated;
+	SourceLocation pendingLocation;
+	std::string pendingLineText;//line of pendingLocation as written; empty if unknown
+	std::ios_base::fmtflags defaultFlags;
+	
+	//move the message written by caller into diagnostics
+	void commitMessage(){
+		if(!isMessagePending) return;
+		isMessagePending=false;
+		std::string message=pendingMessage.str();
+		while((!(message.empty()))&&(message.back()=='\n')) message.pop_back();
+		std::string key(pendingSeverity);
+		key.append(1,'\0').append(pendingCode).append(1,'\0').append(message);
+		DiagnosticSite site;
+		site.location=pendingLocation;
+		site.column=findColumn(pendingLineText,message);
+		auto iter_index=diagnosticIndex.find(key);
+		if(iter_index!=diagnosticIndex.end()){
+			if(iter_index->second!=std::string::npos){
+				Diagnostic& diagnostic=diagnostics[iter_index->second];
+				++diagnostic.count;
+				if(isPendingLocated&&(diagnostic.sites.size()<DIAGNOSTIC_SITE_LIMIT)&&(!(isSameSite(diagnostic.sites.back(),site)))){
+					diagnostic.sites.push_back(site);
+				}
+			}
+			return;
+		}
+		unsigned& countOfCategory=categoryCount[pendingCode];
+		++countOfCategory;
+		if(countOfCategory>categoryLimit){
+			//remembered so that repeats are not counted as distinct messages
+			diagnosticIndex.insert(std::make_pair(key,std::string::npos));
+			return;
+		}
+		Diagnostic diagnostic;
+		diagnostic.severity=pendingSeverity;
+		diagnostic.code=pendingCode;
+		if(isPendingLocated) diagnostic.sites.push_back(site);
+		diagnostic.message.swap(message);
+		diagnostic.count=1;
+		diagnosticIndex.insert(std::make_pair(key,diagnostics.size()));
+		diagnostics.push_back(diagnostic);
+	}
+	
+	std::ostream& beginMessage(const char* severity, const char* code, bool outputLineCount){
+		commitMessage();
+		isMessagePending=true;
+		pendingSeverity=severity;
+		pendingCode=code;
+		isPendingLocated=outputLineCount;
+		if(outputLineCount) pendingLocation=currentLocation();
+		if(outputLineCount&&(sourceLine!=nullptr)){
+			pendingLineText=(*sourceLine);
+		}else{
+			pendingLineText.clear();
+		}
+		pendingMessage.str(std::string());
+		pendingMessage.clear();
+		pendingMessage.flags(defaultFlags);
+		pendingMessage.fill(' ');
+		return pendingMessage;
+	}
+	
+	//1-based column of the first quoted name of message found in lineText, else of the first non-blank character; 0 if unknown
+	static unsigned findColumn(const std::string& lineText, const std::string& message){
+		std::size_t quoteStart=message.find('"');
+		while(quoteStart!=std::string::npos){
+			const std::size_t quoteEnd=message.find('"',quoteStart+1);
+			if(quoteEnd==std::string::npos) break;
+			if(quoteEnd>quoteStart+1){
+				const std::size_t position=lineText.find(message.data()+quoteStart+1,0,quoteEnd-quoteStart-1);
+				if(position!=std::string::npos) return position+1;
+			}
+			quoteStart=message.find('"',quoteEnd+1);
+		}
+		const std::size_t position=lineText.find_first_not_of(WHITESPACE);
+		return (position==std::string::npos)?0:(position+1);
+	}
+	
+	static bool isSameSite(const DiagnosticSite& a, const DiagnosticSite& b){
+		return (a.location.line==b.location.line)&&(a.column==b.column)&&(a.location.fileName==b.location.fileName)&&(a.location.expansionNote==b.location.expansionNote);
+	}
+	
+	//same name for stdin in every format
+	static std::string getFileName(const SourceLocation& location){
+		return location.fileName.empty()?std::string("stdin"):location.fileName;
+	}
+	
+	static void writeField(std::ostream& dest, const std::string& str){
+		dest<<str.length()<<':'<<str;
+	}
+	
+	static bool readField(std::istream& src, std::string& str){
+		std::size_t length=0;
+		char separator=0;
+		src>>length>>separator;
+		if(src.fail()||(separator!=':')) return false;
+		str.resize(length);
+		if(length>0) src.read(&str[0],length);
+		return !(src.fail());
+	}
+	
+	static std::string escapeJson(const std::string& str){
+		std::string result;
+		result.reserve(str.length()+2);
+		for(std::size_t i=0;i<str.length();++i){
+			const unsigned char c=str[i];
+			switch(c){
+				case '"':	result.append("\\\"");	break;
+				case '\\':	result.append("\\\\");	break;
+				case '\n':	result.append("\\n");	break;
+				case '\t':	result.append("\\t");	break;
+				case '\r':	result.append("\\r");	break;
+				default:
+					if(c<0x20){
+						static const char hexDigits[]="0123456789abcdef";
+						result.append("\\u00");
+						result.push_back(hexDigits[c>>4]);
+						result.push_back(hexDigits[c&0xf]);
+					}else{
+						result.push_back(c);
+					}
+			}
+		}
+		return result;
+	}
+	
+	void writeText(){
+		std::ostream& dest=(*problemDest);
+		for(auto iter=diagnostics.begin();iter!=diagnostics.end();++iter){
+			dest<<iter->severity<<": ";
+			if(!(iter->sites.empty())){
+				dest<<"at ";
+				iter->sites.front().location.print(dest);
+				dest<<": ";
+			}
+			dest<<iter->message;
+			if(iter->count>1) dest<<" (repeated "<<iter->count<<" times)";
+			dest<<'\n';
+		}
+		for(auto iter=categoryCount.begin();iter!=categoryCount.end();++iter){
+			if(iter->second>categoryLimit){
+				dest<<"Info: "<<(iter->second-categoryLimit)<<" more distinct message(s) of category \""<<iter->first<<"\" suppressed\n";
+			}
+		}
+	}
+	
+	//fields of one place
+	static void writeJsonSite(std::ostream& dest, const DiagnosticSite& site){
+		dest<<"\"file\":\""<<escapeJson(getFileName(site.location))
+				<<"\",\"line\":"<<site.location.line;
+		if(site.column!=0) dest<<",\"column\":"<<site.column;
+		if(!(site.location.expansionNote.empty())) dest<<",\"note\":\""<<escapeJson(site.location.expansionNote)<<'"';
+	}
+	
+	void writeJson(){
+		std::ostream& dest=(*problemDest);
+		dest<<"[";
+		for(auto iter=diagnostics.begin();iter!=diagnostics.end();++iter){
+			dest<<((iter==diagnostics.begin())?"\n":",\n")
+					<<"{\"severity\":\""<<getLowerCase(iter->severity)
+					<<"\",\"code\":\""<<escapeJson(iter->code)<<'"';
+			if(!(iter->sites.empty())){
+				//first place at top level; all places in "locations"
+				dest<<',';
+				writeJsonSite(dest,iter->sites.front());
+				dest<<",\"locations\":[";
+				for(auto iter_site=iter->sites.begin();iter_site!=iter->sites.end();++iter_site){
+					dest<<((iter_site==iter->sites.begin())?"{":",{");
+					writeJsonSite(dest,*iter_site);
+					dest<<'}';
+				}
+				dest<<']';
+			}
+			dest<<",\"message\":\""<<escapeJson(iter->message)<<"\",\"count\":"<<iter->count<<'}';
+		}
+		dest<<"\n]\n";
+	}
+	
+	void writeSarif(){
+		std::ostream& dest=(*problemDest);
+		dest<<"{\"version\":\"2.1.0\",\"$schema\":\"https://json.schemastore.org/sarif-2.1.0.json\",\"runs\":[{"
+				<<"\"tool\":{\"driver\":{\"name\":\"ECE342_Lab6_Assembler\",\"rules\":[";
+		for(auto iter=categoryCount.begin();iter!=categoryCount.end();++iter){
+			dest<<((iter==categoryCount.begin())?"":",")<<"{\"id\":\""<<escapeJson(iter->first)<<"\"}";
+		}
+		dest<<"]}},\"results\":[";
+		for(auto iter=diagnostics.begin();iter!=diagnostics.end();++iter){
+			const std::string severity=getLowerCase(iter->severity);
+			dest<<((iter==diagnostics.begin())?"\n":",\n")
+					<<"{\"ruleId\":\""<<escapeJson(iter->code)
+					<<"\",\"level\":\""<<((severity=="info")?"note":severity)
+					<<"\",\"message\":{\"text\":\""<<escapeJson(iter->message)<<"\"}";
+			if(!(iter->sites.empty())){
+				dest<<",\"locations\":[";
+				for(auto iter_site=iter->sites.begin();iter_site!=iter->sites.end();++iter_site){
+					dest<<((iter_site==iter->sites.begin())?"":",")
+							<<"{\"physicalLocation\":{\"artifactLocation\":{\"uri\":\""<<escapeJson(getFileName(iter_site->location))
+							<<"\"},\"region\":{\"startLine\":"<<iter_site->location.line;
+					if(iter_site->column!=0) dest<<",\"startColumn\":"<<iter_site->column;
+					dest<<"}}}";
+				}
+				dest<<']';
+			}
+			dest<<",\"occurrenceCount\":"<<iter->count<<'}';
+		}
+		dest<<"\n]}]}\n";
+	}
+	
 public:
 	std::istream* inputSrc;//where do source come
+	std::string inputFileName;//name of source; empty for stdin
 	std::ostream* outputDest;//where do mif go
 	std::ostream* problemDest;//where do warnings/errors/info go
+	unsigned diagnosticFormat;//DIAGNOSTIC_FORMAT_*
+	unsigned categoryLimit;//see DIAGNOSTIC_CATEGORY_LIMIT
+	const std::string* sourceLine;//line being assembled as written (for column of diagnostics); nullptr if none
 	
 	IOManager():
-			lineCount(0),
 			warningCount(0),
 			errorCount(0),
+			isMessagePending(false),
+			pendingSeverity(nullptr),
+			isPendingLocated(false),
 			inputSrc(&std::cin),
 			outputDest(&std::cout),
-			problemDest(&std::cerr){
+			problemDest(&std::cerr),
+			diagnosticFormat(DIAGNOSTIC_FORMAT_TEXT),
+			categoryLimit(DIAGNOSTIC_CATEGORY_LIMIT),
+			sourceLine(nullptr){
+		defaultFlags=pendingMessage.flags();
 	}
 	
-	void input_getline(std::string& dest){
-		std::getline((*inputSrc),dest);
-		++lineCount;
+	//read next line from the innermost source; return false if all input is exhausted
+	bool input_getline(std::string& dest){
+		if(inputStack.empty()&&(inputSrc!=nullptr)){
+			InputFrame mainFrame;
+			mainFrame.stream=inputSrc;
+			mainFrame.nextLine=0;
+			mainFrame.location.fileName=inputFileName;
+			inputStack.push_back(mainFrame);
+			inputSrc=nullptr;
+		}
+		while(!(inputStack.empty())){
+			InputFrame& frame=inputStack.back();
+			if(frame.stream!=nullptr){
+				if(std::getline((*frame.stream),dest)){
+					++frame.location.line;
+					return true;
+				}
+			}else if(frame.nextLine<frame.lines->size()){
+				dest=(*frame.lines)[frame.nextLine];
+				++frame.nextLine;
+				++frame.location.line;
+				return true;
+			}
+			lastLocation=frame.location;
+			inputStack.pop_back();
+		}
+		return false;
+	}
+	
+	const SourceLocation& currentLocation()const{
+		return inputStack.empty()?lastLocation:inputStack.back().location;
+	}
+	
+	//relative path is relative to the file being read
+	std::string resolvePath(const std::string& fileName)const{
+		std::string path=fileName;
+		if((!(path.empty()))&&(path[0]!='/')&&(path[0]!='\\')&&(path.find(':')==std::string::npos)){
+			const std::string& parentName=currentLocation().fileName;
+			std::size_t dirEnd=parentName.find_last_of("\\/");
+			if(dirEnd!=std::string::npos) path.insert(0,parentName,0,dirEnd+1);
+		}
+		return path;
+	}
+	
+	//start reading from given file
+	bool input_include(const std::string& fileName){
+		if(inputStack.size()>=MAX_INPUT_NESTING) return false;
+		const std::string path=resolvePath(fileName);
+		auto iter_file=fileCache.find(path);
+		if(iter_file==fileCache.end()){
+			sourceFiles.push_back(path);
+			std::ifstream ifs(path);
+			if(!(ifs.good())) return false;
+			std::shared_ptr<std::vector<std::string>> content=std::make_shared<std::vector<std::string>>();
+			std::string line;
+			while(std::getline(ifs,line)){
+				content->push_back(line);
+			}
+			iter_file=fileCache.insert(std::make_pair(path,std::shared_ptr<const std::vector<std::string>>(content))).first;
+		}
+		InputFrame frame;
+		frame.stream=nullptr;
+		frame.lines=iter_file->second;
+		frame.nextLine=0;
+		frame.location.fileName=path;
+		inputStack.push_back(frame);
+		return true;
 	}
 	
-	bool input_good(){
-		return inputSrc->good();
+	//start reading expanded macro body; line numbers are the ones in macro definition
+	bool input_expand(const std::shared_ptr<const std::vector<std::string>>& lines, const SourceLocation& bodyLocation, const std::string& macroName){
+		if(inputStack.size()>=MAX_INPUT_NESTING) return false;
+		std::stringstream note;
+		note<<"in macro \""<<macroName<<"\" expanded at ";
+		currentLocation().print(note);
+		InputFrame frame;
+		frame.stream=nullptr;
+		frame.lines=lines;
+		frame.nextLine=0;
+		frame.location=bodyLocation;
+		frame.location.line-=1;
+		frame.location.expansionNote=note.str();
+		inputStack.push_back(frame);
+		return true;
 	}
 	
 	static constexpr bool NoLineCount=false;
 	
-	std::ostream& error(bool outputLineCount=true){
+	//error about a line read before (e.g. evaluated at the end of the first pass)
+	std::ostream& error(const char* code, const SourceLocation& location){
+		std::ostream& dest=error(code);
+		pendingLocation=location;
+		pendingLineText.clear();
+		return dest;
+	}
+	
+	//messages are buffered (and deduplicated) until flushDiagnostics()
+	//code is the category of message
+	std::ostream& error(const char* code, bool outputLineCount=true){
 		++errorCount;
-		(*problemDest)<<"Error: ";
-		if(outputLineCount) (*problemDest)<<"at line "<<lineCount<<": ";
-		return (*problemDest);
+		return beginMessage("Error",code,outputLineCount);
 	}
 	
-	std::ostream& warning(bool outputLineCount=true){
+	std::ostream& warning(const char* code, bool outputLineCount=true){
 		++warningCount;
-		(*problemDest)<<"Warning: ";
-		if(outputLineCount) (*problemDest)<<"at line "<<lineCount<<": ";
-		return (*problemDest);
+		return beginMessage("Warning",code,outputLineCount);
+	}
+	
+	std::ostream& info(const char* code, bool outputLineCount=true){
+		return beginMessage("Info",code,outputLineCount);
+	}
+	
+	//write all messages in selected format
+	void flushDiagnostics(){
+		commitMessage();
+		if(diagnosticFormat==DIAGNOSTIC_FORMAT_JSON){
+			writeJson();
+		}else if(diagnosticFormat==DIAGNOSTIC_FORMAT_SARIF){
+			writeSarif();
+		}else{
+			writeText();
+		}
+		problemDest->flush();
+		diagnostics.clear();
+		diagnosticIndex.clear();
+		categoryCount.clear();
 	}
 	
-	std::ostream& info(bool outputLineCount=true){
-		(*problemDest)<<"Info: ";
-		if(outputLineCount) (*problemDest)<<"at line "<<lineCount<<": ";
-		return (*problemDest);
+	//all messages of this run (for build cache); strings are written as <length>:<content>
+	std::string saveDiagnostics(){
+		commitMessage();
+		std::ostringstream dest;
+		dest<<errorCount<<' '<<warningCount<<' '<<diagnostics.size()<<'\n';
+		for(auto iter=diagnostics.begin();iter!=diagnostics.end();++iter){
+			dest<<iter->severity<<' '<<iter->count<<' '<<iter->sites.size()<<' ';
+			writeField(dest,iter->code);
+			writeField(dest,iter->message);
+			for(auto iter_site=iter->sites.begin();iter_site!=iter->sites.end();++iter_site){
+				dest<<' '<<iter_site->location.line<<' '<<iter_site->column<<' ';
+				writeField(dest,iter_site->location.fileName);
+				writeField(dest,iter_site->location.expansionNote);
+			}
+			dest<<'\n';
+		}
+		dest<<categoryCount.size()<<'\n';
+		for(auto iter=categoryCount.begin();iter!=categoryCount.end();++iter){
+			dest<<iter->second<<' ';
+			writeField(dest,iter->first);
+			dest<<'\n';
+		}
+		return dest.str();
+	}
+	
+	//replace messages by the ones from saveDiagnostics(); return false if content is broken
+	bool restoreDiagnostics(const std::string& content){
+		static const char* const severities[]={"Error","Warning","Info"};
+		std::istringstream src(content);
+		std::size_t diagnosticCount=0;
+		unsigned savedErrorCount=0;
+		unsigned savedWarningCount=0;
+		src>>savedErrorCount>>savedWarningCount>>diagnosticCount;
+		if(src.fail()) return false;
+		std::vector<Diagnostic> savedDiagnostics(diagnosticCount);
+		for(auto iter=savedDiagnostics.begin();iter!=savedDiagnostics.end();++iter){
+			std::string severity;
+			std::size_t siteCount=0;
+			src>>severity>>iter->count>>siteCount;
+			iter->severity=nullptr;
+			for(std::size_t i=0;i<sizeof(severities)/sizeof(severities[0]);++i){
+				if(severity==severities[i]) iter->severity=severities[i];
+			}
+			if((iter->severity==nullptr)||(siteCount>DIAGNOSTIC_SITE_LIMIT)||(!(readField(src,iter->code)&&readField(src,iter->message)))){
+				return false;
+			}
+			iter->sites.resize(siteCount);
+			for(auto iter_site=iter->sites.begin();iter_site!=iter->sites.end();++iter_site){
+				src>>iter_site->location.line>>iter_site->column;
+				if(!(readField(src,iter_site->location.fileName)&&readField(src,iter_site->location.expansionNote))) return false;
+			}
+		}
+		std::size_t categories=0;
+		src>>categories;
+		std::unordered_map<std::string,unsigned> savedCategoryCount;
+		for(std::size_t i=0;i<categories;++i){
+			unsigned count=0;
+			std::string code;
+			src>>count;
+			if(!(readField(src,code))) return false;
+			savedCategoryCount[code]=count;
+		}
+		if(src.fail()) return false;
+		commitMessage();
+		diagnostics.swap(savedDiagnostics);
+		categoryCount.swap(savedCategoryCount);
+		diagnosticIndex.clear();
+		errorCount=savedErrorCount;
+		warningCount=savedWarningCount;
+		return true;
 	}
 	
 	void showCounts(){
@@ -225,6 +1142,8 @@ public:
 	}
 	
 	bool isPauseNeeded(){
+		//nobody is reading if the output is for other programs
+		if(diagnosticFormat!=DIAGNOSTIC_FORMAT_TEXT) return false;
 		return (errorCount>0)||(warningCount>0);
 	}
 	
@@ -268,10 +1187,37 @@ std::string getLowerCase(const std::string& str){
 	return result;
 }
 
+//convert string to lower case in place
+void toLowerCase(std::string& str){
+	std::locale loc;
+	for(std::size_t i=0;i<str.length();++i){
+		str[i]=std::tolower(str[i],loc);
+	}
+}
+
+//split line into whitespace separated fields; fields after the third one are appended to arg2
+void splitFields(const std::string& line, std::string& instr, std::string& arg1, std::string& arg2){
+	std::string* fields[3]={&instr,&arg1,&arg2};
+	std::size_t fieldIndex=0;
+	instr.clear();
+	arg1.clear();
+	arg2.clear();
+	std::size_t pos=0;
+	while(true){
+		while((pos<line.length())&&std::isspace(static_cast<unsigned char>(line[pos]))) ++pos;
+		if(pos==line.length()) break;
+		std::size_t fieldEnd=pos;
+		while((fieldEnd<line.length())&&(!(std::isspace(static_cast<unsigned char>(line[fieldEnd]))))) ++fieldEnd;
+		fields[fieldIndex]->append(line,pos,fieldEnd-pos);
+		if(fieldIndex<2) ++fieldIndex;
+		pos=fieldEnd;
+	}
+}
+
 //lookup register name
 bool convert2Reg(const std::string& arg, content_type& result){
-	auto iter=registerMap.find(getLowerCase(arg));
-	if(iter==registerMap.end()){
+	auto iter=encoding.registerMap.find(getLowerCase(arg));
+	if(iter==encoding.registerMap.end()){
 		return false;
 	}else{
 		result=iter->second;
@@ -290,7 +1236,7 @@ bool convert2Value(const std::string& arg, content_type& result){
 	{
 		content_type tmp2=0;
 		if(convert2Reg(arg,tmp2)){
-			(io.warning())<<"immediate expression \""<<arg<<"\" looks like a register"<<std::endl;
+			(io.warning("register-like-immediate"))<<"immediate expression \""<<arg<<"\" looks like a register"<<std::endl;
 		}
 	}
 	content_type tmp=0;
@@ -343,9 +1289,13 @@ bool convert2Value(const std::string& arg, content_type& result){
 			}catch(...){
 				return false;
 			}*/
-			std::stringstream buf(arg);
-			buf>>tmp;
-			if(buf.fail()) return false;
+			//same as extracting from a stream: leading digits are used, fail on overflow
+			unsigned long long value=0;
+			for(std::size_t i=0;(i<arg.length())&&(arg[i]>='0')&&(arg[i]<='9');++i){
+				value=value*10+(arg[i]-'0');
+				if(value>static_cast<content_type>(-1)) return false;
+			}
+			tmp=value;
 			
 			result=tmp;
 			return true;
@@ -355,6 +1305,7 @@ bool convert2Value(const std::string& arg, content_type& result){
 		auto iter_const=constantMap.find(arg);
 		if(iter_const!=constantMap.end()){
 			result=iter_const->second;
+			if(crossReference.isRecording) crossReference.constantUses[arg].push_back(crossReference.address);
 			return true;
 		}else{
 			return false;
@@ -403,130 +1354,126 @@ bool convert2Value_Expression(const std::string& arg, content_type& result,offse
 	return true;
 }
 */
+void resolveReferencedConstants(const std::string& expression);
+
+//operators in expressions (also used by expression relocations)
+const std::string EXPRESSION_OPERATORS="(+-*/)";
+constexpr std::size_t BR_LEFT=0;
+constexpr std::size_t OP_ADD=1;
+constexpr std::size_t OP_SUB=2;
+constexpr std::size_t OP_MUL=3;
+constexpr std::size_t OP_DIV=4;
+constexpr std::size_t BR_RIGHT=5;
+//make sure constants are the index of the operator in EXPRESSION_OPERATORS
+constexpr unsigned OPERATOR_PRECEDENCE[]={
+	0,//BR_LEFT
+	1,//OP_ADD
+	1,//OP_SUB
+	2,//OP_MUL
+	2,//OP_DIV
+	0//BR_RIGHT(it will never appear on the stack)
+};
+
+//result of operator; false on division by zero
+bool applyArithmetic(std::size_t op, offset_type operand1, offset_type operand2, offset_type& result){
+	switch(op){
+		case OP_ADD:
+			result=operand1+operand2;
+			break;
+		case OP_SUB:
+			result=operand1-operand2;
+			break;
+		case OP_MUL:
+			result=operand1*operand2;
+			break;
+		case OP_DIV:
+			if(operand2==0) return false;
+			result=operand1/operand2;
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+//one step of a parsed expression (reverse polish notation)
+constexpr std::size_t TERM_NUMBER=BR_RIGHT+1;//number or constant
+constexpr std::size_t TERM_NAME=BR_RIGHT+2;//name that is not a constant (yet)
+struct ExpressionTerm{
+	std::size_t kind;//OP_ADD ... OP_DIV, TERM_NUMBER or TERM_NAME
+	offset_type value;//for TERM_NUMBER
+	std::size_t nameStart;//for TERM_NAME: position in parsed text
+	std::size_t nameLength;
+};
+
+//convert infix expression to reverse polish notation; numbers and constants are evaluated
+//return false if the expression is malformed
 //http://stackoverflow.com/questions/13421424/how-to-evaluate-an-infix-expression-in-just-one-scan-using-stacks
-bool convert2Value_Expression(const std::string& arg, content_type& result,offset_type& offset, std::string& label){
-	const std::string operatorString="(+-*/)";
-	constexpr std::size_t BR_LEFT=0;
-	constexpr std::size_t OP_ADD=1;
-	constexpr std::size_t OP_SUB=2;
-	constexpr std::size_t OP_MUL=3;
-	constexpr std::size_t OP_DIV=4;
-	constexpr std::size_t BR_RIGHT=5;
-	//make sure constants are the index of the operator in operatorString
-	const std::vector<unsigned> precedence={
-		0,//BR_LEFT
-		1,//OP_ADD
-		1,//OP_SUB
-		2,//OP_MUL
-		2,//OP_DIV
-		0//BR_RIGHT(it will never appear on the stack)
-	};
-		
+bool parseExpression(const std::string& arg, std::vector<ExpressionTerm>& terms){
+	terms.clear();
 	if(arg.empty()) return false;
-	
-	std::size_t labelIndexPlusOne=0;//zero if no label
-	std::string tmplabel;
-	std::vector<offset_type> operandStack;//for the operand with label: the value stored is the offset (only add and subtract is allowed for labels)
-	std::vector<std::size_t> operatorStack;
+	//reused by every call (not reentrant)
+	static std::string tmpExpression;
+	static std::vector<std::size_t> operatorStack;
+	operatorStack.clear();
+	std::size_t operandCount=0;//operands on the stack when evaluated
 	
 	operatorStack.push_back(BR_LEFT);
 	std::size_t expressionStart=0;
 	bool isRightAfterRightParenthesis=false;
 	while(true){
-		const std::size_t i=arg.find_first_of(operatorString,expressionStart);
+		const std::size_t i=arg.find_first_of(EXPRESSION_OPERATORS,expressionStart);
 		std::size_t opValue=BR_RIGHT;
 		if(i!=std::string::npos){
-			opValue=operatorString.find_first_of(arg[i]);
+			opValue=EXPRESSION_OPERATORS.find_first_of(arg[i]);
 			if(((expressionStart==i)&&(opValue!=BR_LEFT)&&(!isRightAfterRightParenthesis))//no first operand for this operator
 					||((expressionStart<i)&&(opValue==BR_LEFT))//an operand before left parenthesis
 					||((expressionStart<i)&&isRightAfterRightParenthesis)//expression directly after right parenthesis
 					){
-				//(io.warning())<<"Debug: error at left of operator; expressionStart="<<expressionStart<<", i="<<i<<", opValue="<<opValue<<std::endl;
 				return false;
 			}
 		}else{
 			if((expressionStart==arg.length())&&(!isRightAfterRightParenthesis)){//operator or '(' at end of expression
-				//(io.warning())<<"Debug: error at end of expression; expressionStart="<<expressionStart<<", i="<<i<<", opValue="<<opValue<<std::endl;
 				return false;
 			}
 		}
 		if(((i==std::string::npos)&&(expressionStart<arg.length()))||((i!=std::string::npos)&&(expressionStart<i))){//there is something to evaluate
-			std::string tmpExpression;
-			if(i==std::string::npos){
-				tmpExpression=arg.substr(expressionStart);
-			}else{
-				tmpExpression=arg.substr(expressionStart,i-expressionStart);
-			}
+			const std::size_t operandEnd=(i==std::string::npos)?arg.length():i;
+			tmpExpression.assign(arg,expressionStart,operandEnd-expressionStart);
+			ExpressionTerm term;
+			term.value=0;
+			term.nameStart=expressionStart;
+			term.nameLength=operandEnd-expressionStart;
 			content_type tmpResult=0;
 			if(convert2Value(tmpExpression,tmpResult)){
-				operandStack.push_back(static_cast<offset_type>(tmpResult));
+				term.kind=TERM_NUMBER;
+				term.value=static_cast<offset_type>(tmpResult);
+			}else if(isNameValid(tmpExpression.substr(0,tmpExpression.find('@')))){//local labels of linked modules end with "@module"
+				term.kind=TERM_NAME;
 			}else{
-				if((labelIndexPlusOne==0)&&(isNameValid(tmpExpression))){
-					operandStack.push_back(0);//initialize the offset of label to zero
-					labelIndexPlusOne=operandStack.size();
-					tmplabel.swap(tmpExpression);
-				}else{
-					//(io.warning())<<"Debug: error: multiple label; arg.length()="<<arg.length()<<", i="<<i<<", expressionStart="<<expressionStart<<", label:("<<tmplabel<<","<<tmpExpression<<')'<<std::endl;
-					return false;
-				}
+				return false;
 			}
+			terms.push_back(term);
+			++operandCount;
 		}
 		expressionStart=i+1;
 		if(opValue==BR_LEFT){
 			operatorStack.push_back(opValue);
 		}else{
-			while((!(operatorStack.empty()))&&(operatorStack.back()!=BR_LEFT)&&(precedence[operatorStack.back()]>=precedence[opValue])){
-				if(operandStack.size()<2){
-					//(io.warning())<<"Debug: insufficient operand ("<<operandStack.size()<<") for operator "<<operatorStack.back()<<std::endl;
-					return false;
-				}
-				offset_type operand2=operandStack.back();
-				operandStack.pop_back();
-				offset_type operand1=operandStack.back();
-				operandStack.pop_back();
-				if(labelIndexPlusOne>operandStack.size()){
-					//one of the operand is the offset from label
-					if(!((operatorStack.back()==OP_ADD)||((operatorStack.back()==OP_SUB)&&(labelIndexPlusOne-1==operandStack.size())))){
-						//(io.warning())<<"Debug: misuse of label; expressionStart="<<expressionStart<<", i="<<i<<", opValue="<<opValue<<std::endl;
-						return false;//only addition and subtraction is allowed for label. For subtraction, the label must be the first operand
-					}else{
-						offset_type tmpResult=operand1;
-						if(operatorStack.back()==OP_ADD){
-							tmpResult+=operand2;
-						}else{
-							tmpResult-=operand2;
-						}
-						operandStack.push_back(tmpResult);
-						labelIndexPlusOne=operandStack.size();
-					}
-				}else{
-					//two pure number
-					offset_type tmpResult=operand1;
-					switch(operatorStack.back()){
-						case OP_ADD:
-							tmpResult+=operand2;
-							break;
-						case OP_SUB:
-							tmpResult-=operand2;
-							break;
-						case OP_MUL:
-							tmpResult*=operand2;
-							break;
-						case OP_DIV:
-							tmpResult/=operand2;
-							break;
-						default:
-							(io.error())<<"Unhandled operator. Please report this bug."<<std::endl;
-							return false;
-					}
-					operandStack.push_back(tmpResult);
-				}
+			while((!(operatorStack.empty()))&&(operatorStack.back()!=BR_LEFT)&&(OPERATOR_PRECEDENCE[operatorStack.back()]>=OPERATOR_PRECEDENCE[opValue])){
+				if(operandCount<2) return false;
+				--operandCount;
+				ExpressionTerm term;
+				term.kind=operatorStack.back();
+				term.value=0;
+				term.nameStart=0;
+				term.nameLength=0;
+				terms.push_back(term);
 				operatorStack.pop_back();
 			}
 			if(opValue==BR_RIGHT){
 				if((operatorStack.empty())||(operatorStack.back()!=BR_LEFT)){
-					//(io.warning())<<"Debug: No matching '(' for ')'"<<std::endl;
-					return false;
+					return false;//no matching '(' for ')'
 				}else{
 					operatorStack.pop_back();
 					isRightAfterRightParenthesis=true;
@@ -536,398 +1483,3089 @@ bool convert2Value_Expression(const std::string& arg, content_type& result,offse
 				isRightAfterRightParenthesis=false;
 			}
 		}
-		if(i==std::string::npos)break;
+		if(i==std::string::npos)break;
+	}
+	return (operatorStack.empty())&&(operandCount==1);
+}
+
+//evaluate expression; names that are not constants are labels
+//if the expression has no label, then only result will be set
+//if the expression has label, then offset and label will be set (only label+offset or label-offset is allowed)
+bool convert2Value_Expression(const std::string& arg, content_type& result,offset_type& offset, std::string& label){
+	if(arg.empty()) return false;
+	
+	//constants defined later whose dependencies are known by now
+	//(done before the stacks below are used, as it evaluates other expressions)
+	if(!(deferredConstantMap.empty())) resolveReferencedConstants(arg);
+	
+	//reused by every call (not reentrant)
+	static std::vector<ExpressionTerm> terms;
+	static std::vector<offset_type> operandStack;//for the operand with label: the value stored is the offset
+	if(!(parseExpression(arg,terms))) return false;
+	operandStack.clear();
+	std::size_t labelIndexPlusOne=0;//zero if no label
+	const ExpressionTerm* labelTerm=nullptr;
+	for(auto iter_term=terms.begin();iter_term!=terms.end();++iter_term){
+		if(iter_term->kind==TERM_NUMBER){
+			operandStack.push_back(iter_term->value);
+		}else if(iter_term->kind==TERM_NAME){
+			if(labelIndexPlusOne!=0) return false;//expression depends on more than one label
+			if(arg.find('@',iter_term->nameStart)<iter_term->nameStart+iter_term->nameLength) return false;//"@module" only comes from object files
+			operandStack.push_back(0);//initialize the offset of label to zero
+			labelIndexPlusOne=operandStack.size();
+			labelTerm=&(*iter_term);
+		}else{
+			const offset_type operand2=operandStack.back();
+			operandStack.pop_back();
+			const offset_type operand1=operandStack.back();
+			operandStack.pop_back();
+			if(labelIndexPlusOne>operandStack.size()){
+				//one of the operand is the offset from label
+				//only addition and subtraction is allowed for label. For subtraction, the label must be the first operand
+				if(!((iter_term->kind==OP_ADD)||((iter_term->kind==OP_SUB)&&(labelIndexPlusOne-1==operandStack.size())))) return false;
+				operandStack.push_back((iter_term->kind==OP_ADD)?(operand1+operand2):(operand1-operand2));
+				labelIndexPlusOne=operandStack.size();
+			}else{
+				//two pure number
+				offset_type tmpResult=0;
+				if(!(applyArithmetic(iter_term->kind,operand1,operand2,tmpResult))) return false;
+				operandStack.push_back(tmpResult);
+			}
+		}
+	}
+	if(labelTerm==nullptr){
+		result=static_cast<content_type>(operandStack.back());
+	}else{
+		label.assign(arg,labelTerm->nameStart,labelTerm->nameLength);
+		offset=operandStack.back();
+	}
+	return true;
+}
+
+//find pattern outside of double quoted string
+std::size_t findUnquoted(const std::string& str, const std::string& pattern, std::size_t pos=0){
+	bool isQuoted=false;
+	for(std::size_t i=pos;i<str.length();++i){
+		if(isQuoted){
+			if(str[i]=='\\'){
+				++i;
+			}else if(str[i]=='"'){
+				isQuoted=false;
+			}
+		}else if(str[i]=='"'){
+			isQuoted=true;
+		}else if(str.compare(i,pattern.length(),pattern)==0){
+			return i;
+		}
+	}
+	return std::string::npos;
+}
+
+//positions of characters significant to line parsing, found in one scan of the line
+struct LineMarks{
+	std::size_t commentStart;//first "//" outside string; npos if none
+	std::vector<std::size_t> colons;//':' outside string and before comment
+	std::vector<std::size_t> commas;//',' outside string and before comment
+};
+
+inline unsigned countTrailingZeros(unsigned mask){
+#if defined(__GNUC__)
+	return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+	unsigned long index=0;
+	_BitScanForward(&index,mask);
+	return index;
+#else
+	unsigned count=0;
+	while((mask&1)==0){
+		mask>>=1;
+		++count;
+	}
+	return count;
+#endif
+}
+
+inline bool isScanSignificant(char c){
+	return (c=='/')||(c==':')||(c==',')||(c=='"')||(c=='\\');
+}
+
+class LineScanner{
+private:
+	const std::string& line;
+	LineMarks& marks;
+	bool isQuoted;
+	std::size_t escapedPos;//character after '\' in string
+	
+public:
+	LineScanner(const std::string& src, LineMarks& dest):
+			line(src),
+			marks(dest),
+			isQuoted(false),
+			escapedPos(std::string::npos){
+		marks.commentStart=std::string::npos;
+		marks.colons.clear();
+		marks.commas.clear();
+	}
+	
+	//handle one significant character; return true if comment starts here
+	bool handle(std::size_t pos){
+		if(pos==escapedPos) return false;
+		const char c=line[pos];
+		if(isQuoted){
+			if(c=='\\'){
+				escapedPos=pos+1;
+			}else if(c=='"'){
+				isQuoted=false;
+			}
+			return false;
+		}
+		switch(c){
+			case '"':
+				isQuoted=true;
+				break;
+			case '/':
+				if((pos+1<line.length())&&(line[pos+1]=='/')){
+					marks.commentStart=pos;
+					return true;
+				}
+				break;
+			case ':':
+				marks.colons.push_back(pos);
+				break;
+			case ',':
+				marks.commas.push_back(pos);
+				break;
+			default:
+				break;
+		}
+		return false;
+	}
+	
+	//handle every significant character in a chunk; bit i of mask is for line[start+i]
+	bool handleMask(std::size_t start, unsigned mask){
+		while(mask!=0){
+			if(handle(start+countTrailingZeros(mask))) return true;
+			mask&=mask-1;
+		}
+		return false;
+	}
+	
+	void scan(){
+		const char* data=line.data();
+		const std::size_t length=line.length();
+		std::size_t i=0;
+#if defined(SCAN_USE_AVX2)
+		const __m256i slash=_mm256_set1_epi8('/');
+		const __m256i colon=_mm256_set1_epi8(':');
+		const __m256i comma=_mm256_set1_epi8(',');
+		const __m256i quote=_mm256_set1_epi8('"');
+		const __m256i backslash=_mm256_set1_epi8('\\');
+		for(;i+32<=length;i+=32){
+			const __m256i chunk=_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data+i));
+			const __m256i hit=_mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(chunk,slash),_mm256_cmpeq_epi8(chunk,colon)),
+					_mm256_or_si256(_mm256_cmpeq_epi8(chunk,comma),_mm256_or_si256(_mm256_cmpeq_epi8(chunk,quote),_mm256_cmpeq_epi8(chunk,backslash))));
+			if(handleMask(i,static_cast<unsigned>(_mm256_movemask_epi8(hit)))) return;
+		}
+#elif defined(SCAN_USE_SSE2)
+		const __m128i slash=_mm_set1_epi8('/');
+		const __m128i colon=_mm_set1_epi8(':');
+		const __m128i comma=_mm_set1_epi8(',');
+		const __m128i quote=_mm_set1_epi8('"');
+		const __m128i backslash=_mm_set1_epi8('\\');
+		for(;i+16<=length;i+=16){
+			const __m128i chunk=_mm_loadu_si128(reinterpret_cast<const __m128i*>(data+i));
+			const __m128i hit=_mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(chunk,slash),_mm_cmpeq_epi8(chunk,colon)),
+					_mm_or_si128(_mm_cmpeq_epi8(chunk,comma),_mm_or_si128(_mm_cmpeq_epi8(chunk,quote),_mm_cmpeq_epi8(chunk,backslash))));
+			if(handleMask(i,static_cast<unsigned>(_mm_movemask_epi8(hit)))) return;
+		}
+#endif
+		//scalar version for the rest
+		for(;i<length;++i){
+			if(isScanSignificant(data[i])&&handle(i)) return;
+		}
+	}
+};
+
+void scanLine(const std::string& line, LineMarks& marks){
+	LineScanner(line,marks).scan();
+}
+
+//split comma separated operands (commas in string are kept); each operand is trimmed
+std::vector<std::string> splitOperands(const std::string& str){
+	std::vector<std::string> result;
+	std::size_t fieldStart=0;
+	while(true){
+		std::size_t fieldEnd=findUnquoted(str,",",fieldStart);
+		std::string field=str.substr(fieldStart,(fieldEnd==std::string::npos)?std::string::npos:fieldEnd-fieldStart);
+		trim(field);
+		result.push_back(field);
+		if(fieldEnd==std::string::npos) break;
+		fieldStart=fieldEnd+1;
+	}
+	return result;
+}
+
+//fields are concatenated before evaluation
+std::string removeWhitespace(const std::string& str){
+	std::string result;
+	result.reserve(str.length());
+	for(std::size_t i=0;i<str.length();++i){
+		if(WHITESPACE.find(str[i])==std::string::npos) result.push_back(str[i]);
+	}
+	return result;
+}
+
+//decode "..." with escape sequences \n \r \t \0 \\ \" \xHH
+bool convert2String(const std::string& arg, std::string& result){
+	if((arg.length()<2)||(arg.front()!='"')||(arg.back()!='"')) return false;
+	result.clear();
+	for(std::size_t i=1;i+1<arg.length();++i){
+		if(arg[i]!='\\'){
+			if(arg[i]=='"') return false;
+			result.push_back(arg[i]);
+			continue;
+		}
+		++i;
+		if(i+1>=arg.length()) return false;
+		switch(arg[i]){
+			case 'n':	result.push_back('\n');	break;
+			case 'r':	result.push_back('\r');	break;
+			case 't':	result.push_back('\t');	break;
+			case '0':	result.push_back('\0');	break;
+			case '\\':	result.push_back('\\');	break;
+			case '"':	result.push_back('"');	break;
+			case 'x':{
+				unsigned value=0;
+				std::size_t digitCount=0;
+				while((digitCount<2)&&(i+2<arg.length())&&std::isxdigit(static_cast<unsigned char>(arg[i+1]))){
+					++i;
+					++digitCount;
+					value=value*16+((arg[i]<='9')?(arg[i]-'0'):((arg[i]|0x20)-'a'+10));
+				}
+				if(digitCount==0) return false;
+				result.push_back(static_cast<char>(value));
+			}break;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+//record that the content at address depends on a label
+void addPendingLabel(const std::string& label, content_type address, offset_type offset){
+	pendingLabelMap[label].push_back(std::pair<content_type,offset_type>(address,offset));
+}
+
+//part of an expression relocation (reverse polish notation); TERM_NAME is a label
+constexpr std::size_t TERM_EXPRESSION=BR_RIGHT+3;//value of a constant depending on labels
+struct RelocationTerm{
+	std::size_t kind;//OP_ADD ... OP_DIV, TERM_NUMBER, TERM_NAME or TERM_EXPRESSION
+	offset_type value;//for TERM_NUMBER; index in relocatableExpressions for TERM_EXPRESSION
+	std::string name;//for TERM_NAME
+};
+
+//expression using labels, evaluated when labels are resolved (once for all words using it)
+struct RelocatableExpression{
+	std::string text;//fully parenthesized, constants are replaced by their value (by name if they depend on labels); used as key
+	std::vector<RelocationTerm> terms;
+	SourceLocation location;//first use; line is zero if read from object file
+	bool isEvaluated;
+	bool isFailed;//error is already reported
+	bool isByteAddress;//labels are byte addresses (see bytesPerWordAt())
+	offset_type value;
+};
+std::vector<RelocatableExpression> relocatableExpressions;
+ArenaMap<std::size_t> relocatableExpressionIndex;//by text
+
+//constant depending on labels; compiled once, and expressions using it refer to it by TERM_EXPRESSION
+struct SymbolicConstant{
+	std::size_t expression;//index in relocatableExpressions (after the ones it uses)
+	SourceLocation location;
+};
+ArenaMap<
+		SymbolicConstant	//by name of constant
+> symbolicConstantMap;
+
+//index of expression with text; added if it is new
+std::size_t addRelocatableExpression(const std::string& text, std::vector<RelocationTerm>& terms, const SourceLocation& location){
+	auto iter_index=relocatableExpressionIndex.find(text);
+	if(iter_index!=relocatableExpressionIndex.end()) return iter_index->second;
+	relocatableExpressionIndex.insert(std::make_pair(text,relocatableExpressions.size()));
+	relocatableExpressions.emplace_back();
+	RelocatableExpression& expression=relocatableExpressions.back();
+	expression.text=text;
+	expression.terms.swap(terms);
+	expression.location=location;
+	expression.isEvaluated=false;
+	expression.isFailed=false;
+	expression.isByteAddress=false;
+	expression.value=0;
+	return relocatableExpressions.size()-1;
+}
+
+//operand on the stack of compileExpression()
+struct ExpressionFragment{
+	std::vector<RelocationTerm> terms;
+	std::string text;
+	
+	bool isNumber()const{
+		return (terms.size()==1)&&(terms[0].kind==TERM_NUMBER);
+	}
+	
+	void setNumber(offset_type value){
+		terms.assign(1,RelocationTerm());
+		terms[0].kind=TERM_NUMBER;
+		terms[0].value=value;
+		//expressions have no unary minus
+		text=(value<0)?("(0-"+std::to_string(-static_cast<long long>(value))+')'):std::to_string(value);
+	}
+};
+
+//combine the top two operands; numbers are folded
+bool applyOperator(std::size_t op, std::vector<ExpressionFragment>& operands){
+	if(operands.size()<2) return false;
+	ExpressionFragment operand2=std::move(operands.back());
+	operands.pop_back();
+	ExpressionFragment& operand1=operands.back();
+	if(operand1.isNumber()&&operand2.isNumber()){
+		offset_type result=0;
+		if(!(applyArithmetic(op,operand1.terms[0].value,operand2.terms[0].value,result))) return false;
+		operand1.setNumber(result);
+	}else{
+		operand1.terms.insert(operand1.terms.end(),operand2.terms.begin(),operand2.terms.end());
+		operand1.terms.push_back(RelocationTerm());
+		operand1.terms.back().kind=op;
+		operand1.text='('+operand1.text+EXPRESSION_OPERATORS[op]+operand2.text+')';
+	}
+	return true;
+}
+
+//compile expression for a relocation; any name that is not a constant is a label
+//constants depending on labels are referred to by name in text, and operators on numbers only are folded
+bool compileExpression(const std::string& arg, std::vector<RelocationTerm>& terms, std::string& text){
+	std::vector<ExpressionTerm> parsedTerms;
+	if(!(parseExpression(arg,parsedTerms))) return false;
+	std::vector<ExpressionFragment> operandStack;
+	for(auto iter_term=parsedTerms.begin();iter_term!=parsedTerms.end();++iter_term){
+		if(iter_term->kind==TERM_NUMBER){
+			operandStack.emplace_back();
+			operandStack.back().setNumber(iter_term->value);
+		}else if(iter_term->kind==TERM_NAME){
+			const std::string name=arg.substr(iter_term->nameStart,iter_term->nameLength);
+			operandStack.emplace_back();
+			ExpressionFragment& fragment=operandStack.back();
+			auto iter_symbolic=symbolicConstantMap.find(name);
+			if(iter_symbolic!=symbolicConstantMap.end()){
+				fragment.terms.assign(1,RelocationTerm());
+				fragment.terms[0].kind=TERM_EXPRESSION;
+				fragment.terms[0].value=static_cast<offset_type>(iter_symbolic->second.expression);
+				fragment.text=name;
+			}else if(deferredConstantMap.find(name)==deferredConstantMap.end()){
+				fragment.terms.assign(1,RelocationTerm());
+				fragment.terms[0].kind=TERM_NAME;
+				fragment.terms[0].name=name;
+				fragment.text=name;
+			}else{
+				return false;//constant that cannot be evaluated
+			}
+		}else if(!(applyOperator(iter_term->kind,operandStack))){
+			return false;
+		}
+	}
+	terms.swap(operandStack.back().terms);
+	text.swap(operandStack.back().text);
+	return true;
+}
+
+//record that words [address,address+count) hold the value of expression, evaluated when labels are resolved
+//return false if the expression is invalid
+bool addExpressionRelocation(const std::string& arg, content_type address, content_type count, const SourceLocation& location){
+	std::vector<RelocationTerm> terms;
+	std::string text;
+	if(!(compileExpression(arg,terms,text))) return false;
+	if((terms.size()==1)&&(terms[0].kind==TERM_NUMBER)){
+		for(content_type i=address;i<address+count;++i){
+			assembly[i]=static_cast<content_type>(terms[0].value);
+		}
+		return true;
+	}
+	const std::size_t index=addRelocatableExpression(text,terms,location);
+	for(content_type i=address;i<address+count;++i){
+		ExpressionRelocation relocation;
+		relocation.address=i;
+		relocation.expression=index;
+		expressionRelocations.push_back(relocation);
+	}
+	return true;
+}
+
+//value of one expression whose TERM_EXPRESSION operands are evaluated; see evaluateRelocatableExpression()
+bool evaluateExpressionTerms(RelocatableExpression& expression, bool isByteAddress){
+	expression.isEvaluated=true;
+	expression.isByteAddress=isByteAddress;
+	static std::vector<offset_type> operandStack;
+	operandStack.clear();
+	for(auto iter_term=expression.terms.begin();iter_term!=expression.terms.end();++iter_term){
+		if(iter_term->kind==TERM_NUMBER){
+			operandStack.push_back(iter_term->value);
+		}else if(iter_term->kind==TERM_EXPRESSION){
+			const RelocatableExpression& operand=relocatableExpressions[iter_term->value];
+			if(operand.isFailed){
+				//error is reported for the constant
+				expression.isFailed=true;
+				return false;
+			}
+			operandStack.push_back(operand.value);
+		}else if(iter_term->kind==TERM_NAME){
+			auto iter_label=labelMap.find(iter_term->name);
+			if(iter_label==labelMap.end()){
+				expression.isFailed=true;
+				std::ostream& errorDest=(expression.location.line==0)?(io.error("undefined-label",IOManager::NoLineCount)):(io.error("undefined-label",expression.location));
+				errorDest<<"when resolving labels: label \""<<iter_term->name<<"\" in expression \""<<expression.text<<"\" is not found"<<std::endl;
+				return false;
+			}
+			operandStack.push_back(static_cast<offset_type>(isByteAddress?(iter_label->second*bytesPerWordAt(iter_label->second)):iter_label->second));
+		}else{
+			const offset_type operand2=operandStack.back();
+			operandStack.pop_back();
+			if(!(applyArithmetic(iter_term->kind,operandStack.back(),operand2,operandStack.back()))){
+				expression.isFailed=true;
+				std::ostream& errorDest=(expression.location.line==0)?(io.error("invalid-immediate",IOManager::NoLineCount)):(io.error("invalid-immediate",expression.location));
+				errorDest<<"division by zero when evaluating \""<<expression.text<<'"'<<std::endl;
+				return false;
+			}
+		}
+	}
+	expression.value=operandStack.back();
+	return true;
+}
+
+//value of expression with labels as word or byte addresses; computed once for each kind of address
+//constants it uses are evaluated first (with an explicit stack, as they may form long chains)
+bool evaluateRelocatableExpression(RelocatableExpression& expression, bool isByteAddress){
+	auto isDone=[isByteAddress](const RelocatableExpression& candidate)->bool{
+		return candidate.isFailed||(candidate.isEvaluated&&(candidate.isByteAddress==isByteAddress));
+	};
+	static std::vector<RelocatableExpression*> pending;
+	pending.clear();
+	pending.push_back(&expression);
+	while(!(pending.empty())){
+		RelocatableExpression& top=*(pending.back());
+		if(isDone(top)){
+			pending.pop_back();
+			continue;
+		}
+		bool isReady=true;
+		for(auto iter_term=top.terms.begin();iter_term!=top.terms.end();++iter_term){
+			if((iter_term->kind==TERM_EXPRESSION)&&(!(isDone(relocatableExpressions[iter_term->value])))){
+				pending.push_back(&(relocatableExpressions[iter_term->value]));
+				isReady=false;
+			}
+		}
+		if(isReady){
+			evaluateExpressionTerms(top,isByteAddress);
+			pending.pop_back();
+		}
+	}
+	return !(expression.isFailed);
+}
+
+//names (of constants or labels) in expression
+void collectNames(const std::string& expression, std::vector<std::string>& names){
+	names.clear();
+	std::locale loc;
+	std::size_t i=0;
+	while(i<expression.length()){
+		std::size_t nameEnd=i;
+		while((nameEnd<expression.length())&&(std::isalnum(expression[nameEnd],loc)||(expression[nameEnd]=='_'))) ++nameEnd;
+		if(nameEnd==i){
+			++i;
+			continue;
+		}
+		if(!(std::isdigit(expression[i],loc))) names.push_back(expression.substr(i,nameEnd-i));
+		i=nameEnd;
+	}
+}
+
+//deferred constant on the stack of resolveDeferredConstant()
+struct DeferredConstantFrame{
+	std::string name;
+	DeferredConstant* constant;//entries are only erased after their frame is popped, so this stays valid
+	std::vector<std::string> dependencies;
+	std::size_t dependencyIndex;//next dependency to resolve
+	bool isDependencyGood;
+};
+
+//evaluate one deferred constant whose dependencies are resolved (or known to fail); see resolveDeferredConstant()
+bool evaluateDeferredConstant(DeferredConstantFrame& frame, bool isReporting){
+	DeferredConstant& constant=*(frame.constant);
+	constant.isEvaluating=false;
+	if(!(frame.isDependencyGood)) return false;
+	content_type value=0;
+	offset_type offset=0;
+	std::string label;
+	//constants used by a constant are not uses by the instruction being assembled
+	const bool isRecording=crossReference.isRecording;
+	crossReference.isRecording=false;
+	const bool isGood=convert2Value_Expression(constant.expression,value,offset,label)&&label.empty();
+	crossReference.isRecording=isRecording;
+	if(!isGood){
+		if(isReporting&&(!(constant.isFailed))){
+			//all labels are known now; a constant using them is substituted into expressions using it
+			std::vector<RelocationTerm> terms;
+			std::string text;
+			if(compileExpression(constant.expression,terms,text)){
+				SymbolicConstant symbolic;
+				symbolic.expression=addRelocatableExpression(text,terms,constant.location);
+				symbolic.location=constant.location;
+				symbolicConstantMap.insert(std::make_pair(frame.name,symbolic));
+				deferredConstantMap.erase(frame.name);
+				return false;
+			}
+			constant.isFailed=true;
+			(io.error("invalid-constant",constant.location))<<"constant \""<<frame.name<<"\" has invalid expression (\""<<constant.expression<<"\")"<<std::endl;
+		}
+		return false;
+	}
+	constantMap.insert(std::pair<std::string,content_type>(frame.name,value));
+	deferredConstantMap.erase(frame.name);
+#ifdef INFO_SHOW_CONSTANT_WHEN_PARSED
+	(io.info("constant-value",IOManager::NoLineCount))<<"constant \""<<frame.name<<"\" = "<<value<<std::endl;
+#endif
+	return true;
+}
+
+//evaluate deferred constant after its dependencies (depth first, i.e. in topological order of dependency graph)
+//an explicit stack is used, as generated headers may chain any number of constants defined later
+//errors are only reported at the end of the first pass; before that, a failure only means it is not known yet
+bool resolveDeferredConstant(const std::string& name, bool isReporting){
+	std::vector<DeferredConstantFrame> stack;
+	//push frame for constant, or set result if it needs no evaluation
+	auto enter=[&stack,isReporting](const std::string& constantName, bool& result)->bool{
+		auto iter_deferred=deferredConstantMap.find(constantName);
+		if(iter_deferred==deferredConstantMap.end()){
+			result=constantMap.find(constantName)!=constantMap.end();
+			return false;
+		}
+		DeferredConstant& constant=iter_deferred->second;
+		result=false;
+		if(constant.isFailed||((!isReporting)&&(constant.failedGeneration==constantGeneration))) return false;
+		if(constant.isEvaluating){
+			if(isReporting){
+				constant.isFailed=true;
+				(io.error("circular-constant",constant.location))<<"constant \""<<constantName<<"\" depends on itself (\""<<constant.expression<<"\")"<<std::endl;
+			}
+			return false;
+		}
+		constant.isEvaluating=true;
+		DeferredConstantFrame frame;
+		frame.name=constantName;
+		frame.constant=&constant;
+		collectNames(constant.expression,frame.dependencies);
+		frame.dependencyIndex=0;
+		frame.isDependencyGood=true;
+		stack.push_back(std::move(frame));
+		return true;
+	};
+	bool result=false;
+	if(!(enter(name,result))) return result;
+	bool isDependencyResolved=false;//result is for dependencyIndex of top frame
+	while(true){
+		DeferredConstantFrame& frame=stack.back();
+		if(isDependencyResolved){
+			const std::string& dependency=frame.dependencies[frame.dependencyIndex];
+			if((!result)&&(symbolicConstantMap.find(dependency)==symbolicConstantMap.end())){
+				frame.isDependencyGood=false;
+				if(isReporting&&(!(frame.constant->isFailed))){
+					frame.constant->isFailed=true;
+					(io.error("invalid-constant",frame.constant->location))<<"constant \""<<frame.name<<"\" depends on \""<<dependency<<"\", which cannot be evaluated"<<std::endl;
+				}
+			}
+			++frame.dependencyIndex;
+			isDependencyResolved=false;
+		}else if(frame.dependencyIndex<frame.dependencies.size()){
+			if(deferredConstantMap.find(frame.dependencies[frame.dependencyIndex])==deferredConstantMap.end()){
+				++frame.dependencyIndex;
+			}else if(!(enter(frame.dependencies[frame.dependencyIndex],result))){
+				isDependencyResolved=true;
+			}
+		}else{
+			result=evaluateDeferredConstant(frame,isReporting);
+			if((!result)&&(!isReporting)){
+				//not known yet (the constant is still deferred)
+				frame.constant->failedGeneration=constantGeneration;
+				for(auto iter_name=frame.dependencies.begin();iter_name!=frame.dependencies.end();++iter_name){
+					if((constantMap.find(*iter_name)==constantMap.end())&&(deferredConstantMap.find(*iter_name)==deferredConstantMap.end())
+							&&(symbolicConstantMap.find(*iter_name)==symbolicConstantMap.end())){
+						missingConstantNames.insert(*iter_name);
+					}
+				}
+			}
+			stack.pop_back();
+			if(stack.empty()) return result;
+			isDependencyResolved=true;
+		}
+	}
+}
+
+void resolveReferencedConstants(const std::string& expression){
+	std::vector<std::string> names;
+	collectNames(expression,names);
+	for(auto iter_name=names.begin();iter_name!=names.end();++iter_name){
+		if(deferredConstantMap.find(*iter_name)!=deferredConstantMap.end()) resolveDeferredConstant(*iter_name,false);
+	}
+}
+
+//true if expression uses a name that is not a constant yet (constant defined later or label)
+bool hasNonConstantName(const std::string& expression){
+	std::vector<std::string> names;
+	collectNames(expression,names);
+	for(auto iter_name=names.begin();iter_name!=names.end();++iter_name){
+		if(constantMap.find(*iter_name)==constantMap.end()) return true;
+	}
+	return false;
+}
+
+//write value of expression into words [address,address+count)
+//expressions using names defined later or more than label+offset are evaluated at the end of the first pass
+//return false if the expression is invalid
+bool setImmediate(const std::string& arg, content_type address, content_type count){
+	crossReference.address=address;
+	content_type immediate=0;
+	offset_type offset=0;
+	std::string label;
+	if(convert2Value_Expression(arg,immediate,offset,label)){
+		for(content_type i=address;i<address+count;++i){
+			if(label.empty()){
+				assembly[i]=immediate;
+			}else{
+				addPendingLabel(label,i,offset);
+			}
+		}
+		return true;
+	}
+	if(!(hasNonConstantName(arg))) return false;
+	DeferredExpression deferred;
+	deferred.expression=arg;
+	deferred.address=address;
+	deferred.count=count;
+	deferred.bank=currentBank;
+	deferred.location=io.currentLocation();
+	deferredExpressions.push_back(deferred);
+	return true;
+}
+
+//end of the first pass: evaluate constants defined after use and expressions depending on them
+void resolveDeferred(){
+	for(auto iter_name=deferredConstantOrder.begin();iter_name!=deferredConstantOrder.end();++iter_name){
+		resolveDeferredConstant(*iter_name,true);
+	}
+	for(auto iter_expr=deferredExpressions.begin();iter_expr!=deferredExpressions.end();++iter_expr){
+		selectBank(iter_expr->bank);
+		content_type immediate=0;
+		offset_type offset=0;
+		std::string label;
+		if(convert2Value_Expression(iter_expr->expression,immediate,offset,label)){
+			for(content_type i=iter_expr->address;i<iter_expr->address+iter_expr->count;++i){
+				if(label.empty()){
+					assembly[i]=immediate;
+				}else{
+					addPendingLabel(label,i,offset);
+				}
+			}
+		}else if(!(addExpressionRelocation(iter_expr->expression,iter_expr->address,iter_expr->count,iter_expr->location))){
+			(io.error("invalid-immediate",iter_expr->location))<<"failed to interpret \""<<iter_expr->expression<<"\" as immediate value"<<std::endl;
+			continue;
+		}
+		if(runOptions.isListing&&(iter_expr->bank==0)){
+			std::vector<std::string> names;
+			collectNames(iter_expr->expression,names);
+			for(auto iter_name=names.begin();iter_name!=names.end();++iter_name){
+				if(constantMap.find(*iter_name)!=constantMap.end()) crossReference.constantUses[*iter_name].push_back(iter_expr->address);
+			}
+		}
+	}
+	//a name taken as label (used before definition) may turn out to be a constant
+	for(std::size_t bankIndex=0;bankIndex<banks.size();++bankIndex){
+		selectBank(bankIndex);
+		for(auto iter=pendingLabelMap.begin();iter!=pendingLabelMap.end();){
+			if(labelMap.find(iter->first)!=labelMap.end()){
+				++iter;
+				continue;
+			}
+			if(deferredConstantMap.find(iter->first)!=deferredConstantMap.end()){
+				//error of the constant is already reported
+				iter=pendingLabelMap.erase(iter);
+				continue;
+			}
+			auto iter_symbolic=symbolicConstantMap.find(iter->first);
+			if(iter_symbolic!=symbolicConstantMap.end()){
+				for(auto iter_eval=iter->second.begin();iter_eval!=iter->second.end();++iter_eval){
+					std::string expression=iter->first;
+					if(iter_eval->second!=0) expression+=(iter_eval->second>0)?('+'+std::to_string(iter_eval->second)):('-'+std::to_string(-static_cast<long long>(iter_eval->second)));
+					addExpressionRelocation(expression,iter_eval->first,1,iter_symbolic->second.location);
+				}
+				iter=pendingLabelMap.erase(iter);
+				continue;
+			}
+			auto iter_const=constantMap.find(iter->first);
+			if(iter_const==constantMap.end()){
+				++iter;
+				continue;
+			}
+			for(auto iter_eval=iter->second.begin();iter_eval!=iter->second.end();++iter_eval){
+				assembly[iter_eval->first]=iter_const->second+iter_eval->second;
+				if(runOptions.isListing&&(bankIndex==0)) crossReference.constantUses[iter->first].push_back(iter_eval->first);
+			}
+			iter=pendingLabelMap.erase(iter);
+		}
+	}
+	selectBank(0);
+}
+
+//evaluate expression and append it as one word of data
+void appendDataWord(const std::string& arg, const std::string& codeComment){
+	assembly.push_back(PADD_NOOP);
+	comment_code.emplace_back(codeComment.data(),codeComment.length());
+	if(!(setImmediate(arg,assembly.size()-1,1))){
+		(io.error("invalid-immediate"))<<"failed to interpret \""<<arg<<"\" as immediate value"<<std::endl;
+	}
+}
+
+//largest DEPTH of a memory: limits growth by #fill / #incbin and the mif files read (words are allocated for the whole depth)
+constexpr unsigned long long MIF_MAX_DEPTH=1ULL<<24;
+//largest WIDTH of a mif file read (a word is held in unsigned long long)
+constexpr unsigned long long MIF_MAX_WIDTH=64;
+
+//true if wordCount more words keep the current memory within MIF_MAX_DEPTH
+//like #data, words past __DEPTH__ are fine (the depth grows with a warning, see getOutputFormat())
+bool isWithinMaxDepth(unsigned long long wordCount, const char* directive){
+	const unsigned long long used=assembly.size();
+	if((used>MIF_MAX_DEPTH)||(wordCount>MIF_MAX_DEPTH-used)){
+		(io.error("invalid-operand"))<<directive<<" of "<<wordCount<<" word(s) exceeds the largest depth ("<<MIF_MAX_DEPTH<<')'<<std::endl;
+		return false;
+	}
+	return true;
+}
+
+//bytes packed into each word by #string / #incbin
+std::size_t bytesPerDataWord(){
+	std::size_t bytesPerWord=currentWidth()/8;
+	if(bytesPerWord>sizeof(unsigned long long)) bytesPerWord=sizeof(unsigned long long);
+	if(bytesPerWord==0) bytesPerWord=1;
+	return bytesPerWord;
+}
+
+//pack bytes into words (__WIDTH__/8 bytes per word, first byte in least significant bits; last word zero padded)
+void appendBytes(const unsigned char* data, std::size_t length, const std::string& codeComment){
+	const std::size_t bytesPerWord=bytesPerDataWord();
+	const std::size_t start=assembly.size();
+	const std::size_t wordCount=(length+bytesPerWord-1)/bytesPerWord;
+	if(wordCount==0) return;
+	assembly.resize(start+wordCount,PADD_NOOP);
+	comment_code.resize(start+wordCount);
+	comment_code[start].assign(codeComment.data(),codeComment.length());
+	unsigned long long* dest=assembly.data()+start;
+	for(std::size_t i=0;i<length;++i){
+		dest[i/bytesPerWord]|=static_cast<unsigned long long>(data[i])<<(8*(i%bytesPerWord));
+	}
+}
+
+//state of conditional assembly (one entry per nested #if)
+struct ConditionalState{
+	bool isActive;//lines in current branch are processed
+	bool isBranchTaken;//one of the branches is (or was) active
+	bool isElseSeen;
+};
+
+struct PreprocessorState{
+	std::vector<ConditionalState> conditionals;
+	bool isDefiningMacro;
+	std::string macroName;
+	MacroDefinition macro;
+	std::shared_ptr<std::vector<std::string>> macroBody;
+	unsigned expansionCount;//used to substitute "\@"
+	
+	PreprocessorState():isDefiningMacro(false),expansionCount(0){}
+	
+	bool isActive()const{
+		return conditionals.empty()||conditionals.back().isActive;
+	}
+};
+
+//evaluate the condition of #if / #elif; only constants can be used
+bool evaluateCondition(const std::string& arg){
+	std::string expression;
+	for(std::size_t i=0;i<arg.length();++i){
+		if(WHITESPACE.find(arg[i])==std::string::npos) expression.push_back(arg[i]);
+	}
+	content_type value=0;
+	offset_type offset=0;
+	std::string label;
+	if(!(convert2Value_Expression(expression,value,offset,label))){
+		(io.error("invalid-condition"))<<"failed to evaluate condition \""<<arg<<'"'<<std::endl;
+		return false;
+	}else if(!(label.empty())){
+		(io.error("invalid-condition"))<<"condition \""<<arg<<"\" depends on undefined constant or label \""<<label<<'"'<<std::endl;
+		return false;
+	}
+	return value!=0;
+}
+
+//handle preprocessor directives and conditional assembly
+//return true if the line is consumed by preprocessor
+bool preprocess(const std::string& line, PreprocessorState& state){
+	std::string directive;
+	std::string rest;
+	std::size_t directiveStart=line.find_first_not_of(WHITESPACE);
+	if((directiveStart!=std::string::npos)&&(line[directiveStart]=='#')){
+		std::size_t directiveEnd=line.find_first_of(WHITESPACE,directiveStart);
+		if(directiveEnd==std::string::npos) directiveEnd=line.length();
+		directive=getLowerCase(line.substr(directiveStart,directiveEnd-directiveStart));
+		rest=line.substr(directiveEnd);
+		trim(rest);
+	}
+	
+	//macro body is recorded as is
+	if(state.isDefiningMacro){
+		if(directive==DIRECTIVE_ENDMACRO){
+			state.isDefiningMacro=false;
+			state.macro.body=state.macroBody;
+			macroMap.insert(std::make_pair(state.macroName,state.macro));
+			state.macroBody.reset();
+		}else if(directive==DIRECTIVE_MACRO){
+			(io.error("nested-macro"))<<"nested macro definition is not allowed (in definition of \""<<state.macroName<<"\")"<<std::endl;
+			state.macroBody->push_back(std::string());
+		}else{
+			state.macroBody->push_back(line);
+		}
+		return true;
+	}
+	
+	if((directive==DIRECTIVE_IF)||(directive==DIRECTIVE_IFDEF)||(directive==DIRECTIVE_IFNDEF)){
+		ConditionalState cond={false,true,false};
+		if(state.isActive()){
+			if(directive==DIRECTIVE_IF){
+				cond.isActive=evaluateCondition(rest);
+			}else{
+				if(!(isNameValid(rest))){
+					(io.error("invalid-name"))<<"invalid name \""<<rest<<"\" after "<<directive<<std::endl;
+				}
+				bool isDefined=(constantMap.find(rest)!=constantMap.end())||(deferredConstantMap.find(rest)!=deferredConstantMap.end())||(macroMap.find(rest)!=macroMap.end());
+				cond.isActive=(isDefined==(directive==DIRECTIVE_IFDEF));
+			}
+			cond.isBranchTaken=cond.isActive;
+		}
+		state.conditionals.push_back(cond);
+		return true;
+	}else if((directive==DIRECTIVE_ELIF)||(directive==DIRECTIVE_ELSE)){
+		if(state.conditionals.empty()){
+			(io.error("unmatched-conditional"))<<directive<<" without matching #if"<<std::endl;
+		}else{
+			ConditionalState& cond=state.conditionals.back();
+			if(cond.isElseSeen){
+				(io.error("unmatched-conditional"))<<directive<<" after #else"<<std::endl;
+			}
+			if(cond.isBranchTaken){
+				cond.isActive=false;
+			}else if(directive==DIRECTIVE_ELIF){
+				cond.isActive=evaluateCondition(rest);
+				cond.isBranchTaken=cond.isActive;
+			}else{
+				cond.isActive=true;
+				cond.isBranchTaken=true;
+			}
+			if(directive==DIRECTIVE_ELSE) cond.isElseSeen=true;
+		}
+		return true;
+	}else if(directive==DIRECTIVE_ENDIF){
+		if(state.conditionals.empty()){
+			(io.error("unmatched-conditional"))<<"#endif without matching #if"<<std::endl;
+		}else{
+			state.conditionals.pop_back();
+		}
+		return true;
+	}
+	
+	if(!(state.isActive())) return true;
+	
+	if(directive==DIRECTIVE_INCLUDE){
+		std::string fileName=rest;
+		if((fileName.length()>=2)&&(((fileName.front()=='"')&&(fileName.back()=='"'))||((fileName.front()=='<')&&(fileName.back()=='>')))){
+			fileName=fileName.substr(1,fileName.length()-2);
+		}
+		if(fileName.empty()){
+			(io.error("include-failed"))<<"missing file name after #include"<<std::endl;
+		}else if(!(io.input_include(fileName))){
+			(io.error("include-failed"))<<"failed to include \""<<fileName<<"\" (file not readable or nested too deep)"<<std::endl;
+		}
+		return true;
+	}else if(directive==DIRECTIVE_MACRO){
+		for(std::size_t i=0;i<rest.length();++i){
+			if(rest[i]==',') rest[i]=' ';
+		}
+		std::stringstream buf(rest);
+		std::string name;
+		buf>>name;
+		MacroDefinition macro;
+		std::string parameter;
+		while(buf>>parameter){
+			if(!(isNameValid(parameter))){
+				(io.error("invalid-name"))<<"invalid parameter name \""<<parameter<<"\" in definition of macro \""<<name<<'"'<<std::endl;
+			}
+			macro.parameters.push_back(parameter);
+		}
+		if(!(isNameValid(name))){
+			(io.error("invalid-name"))<<"macro name \""<<name<<"\" is invalid"<<std::endl;
+		}else if(macroMap.find(name)!=macroMap.end()){
+			(io.error("macro-redefined"))<<"macro \""<<name<<"\" is already defined"<<std::endl;
+		}
+		//the body is still recorded so that it will not be assembled
+		macro.location=io.currentLocation();
+		macro.location.line+=1;
+		state.isDefiningMacro=true;
+		state.macroName=name;
+		state.macro=macro;
+		state.macroBody=std::make_shared<std::vector<std::string>>();
+		return true;
+	}else if(directive==DIRECTIVE_ENDMACRO){
+		(io.error("unmatched-macro"))<<"#endmacro without matching #macro"<<std::endl;
+		return true;
+	}
+	return false;
+}
+
+//substitute parameters in macro body and start reading the expanded lines
+void expandMacro(const std::string& name, const MacroDefinition& macro, const std::string& argText, PreprocessorState& state){
+	std::vector<std::string> arguments;
+	std::size_t argStart=0;
+	while(argStart<=argText.length()){
+		std::size_t argEnd=argText.find(',',argStart);
+		if(argEnd==std::string::npos) argEnd=argText.length();
+		std::string argument=argText.substr(argStart,argEnd-argStart);
+		trim(argument);
+		arguments.push_back(argument);
+		argStart=argEnd+1;
+	}
+	if((arguments.size()==1)&&(arguments.front().empty())) arguments.clear();
+	if(arguments.size()!=macro.parameters.size()){
+		(io.error("macro-argument-count"))<<"macro \""<<name<<"\" expects "<<macro.parameters.size()<<" argument(s) but "<<arguments.size()<<" is given"<<std::endl;
+		return;
+	}
+	
+	std::string uniqueSuffix=std::to_string(state.expansionCount++);
+	std::locale loc;
+	std::shared_ptr<std::vector<std::string>> expanded=std::make_shared<std::vector<std::string>>();
+	expanded->reserve(macro.body->size());
+	for(auto iter_line=macro.body->begin();iter_line!=macro.body->end();++iter_line){
+		const std::string& src=(*iter_line);
+		std::string dest;
+		std::size_t i=0;
+		while(i<src.length()){
+			if((src[i]=='\\')&&(i+1<src.length())&&(src[i+1]=='@')){
+				dest.append(uniqueSuffix);
+				i+=2;
+			}else if(std::isalnum(src[i],loc)||(src[i]=='_')){
+				//whole identifier (or number, which is never substituted)
+				std::size_t tokenEnd=i;
+				while((tokenEnd<src.length())&&(std::isalnum(src[tokenEnd],loc)||(src[tokenEnd]=='_'))) ++tokenEnd;
+				std::string token=src.substr(i,tokenEnd-i);
+				std::size_t paramIndex=0;
+				while((paramIndex<macro.parameters.size())&&(macro.parameters[paramIndex]!=token)) ++paramIndex;
+				if(paramIndex<macro.parameters.size()){
+					dest.append(arguments[paramIndex]);
+				}else{
+					dest.append(token);
+				}
+				i=tokenEnd;
+			}else{
+				dest.push_back(src[i]);
+				++i;
+			}
+		}
+		expanded->push_back(dest);
+	}
+	if(!(io.input_expand(expanded,macro.location,name))){
+		(io.error("macro-nesting"))<<"macro \""<<name<<"\" is nested too deep"<<std::endl;
+	}
+}
+
+//first pass: read source, fill assembly and record labels and dependency on labels
+void assemble(unsigned depth){
+	for(auto iter_option=optionVec.begin();iter_option!=optionVec.end();++iter_option){
+		constantMap.insert((*iter_option));
+	}
+	//instruction set given by -isa; IR uses the highest bits by default
+	constantMap.at(OPTION_ISA)=runOptions.isaIndex;
+	encoding.select(ISA_TABLE[runOptions.isaIndex]);
+	constantMap.at(OPTION_IROffset)=constantMap.at(OPTION_WIDTH)-encoding.isa->irBits();
+	encoding.rightPadding=constantMap.at(OPTION_IROffset);
+	assembly.reserve(depth);
+	comment_code.reserve(depth);
+	
+	//warning if a label is labeling a non-instruction (constants definition)
+	bool isThisAddressLabelled=false;
+	
+	PreprocessorState ppState;
+	
+	//reused for every line
+	std::string line;
+	std::string labelName;
+	std::string rawLine;//line as written; for listing and column of diagnostics
+	std::string operandText;//operands as written (for macro and directives taking list or string)
+	std::string instr;
+	std::string arg1;
+	std::string arg2;
+	std::string codeComment;
+	LineMarks marks;
+	io.sourceLine=&rawLine;
+	while(io.input_getline(line)){
+		if((!(line.empty()))&&(line.back()=='\n')) line.pop_back();
+		if((!(line.empty()))&&(line.back()=='\r')) line.pop_back();
+		rawLine=line;
+		
+		//find comment, labels and separators in one scan
+		scanLine(line,marks);
+		
+		//ignore comment
+		if(marks.commentStart!=std::string::npos) line.resize(marks.commentStart);
+		
+		//directives, conditional assembly and macro definition
+		if(preprocess(line,ppState)) continue;
+		
+		if(runOptions.isListing&&(currentBank==0)&&(line.find_first_not_of(WHITESPACE)!=std::string::npos)){
+			ListingLine listingLine;
+			listingLine.address=assembly.size();
+			listingLine.location=io.currentLocation();
+			listingLine.text=rawLine;
+			crossReference.lines.push_back(std::move(listingLine));
+		}
+		
+		//find if any labels are defined here
+		std::size_t lineStart=0;
+		for(auto iter_colon=marks.colons.begin();iter_colon!=marks.colons.end();++iter_colon){
+			labelName.assign(line,lineStart,(*iter_colon)-lineStart);
+			lineStart=(*iter_colon)+1;//skip the ':' as well
+			
+			//trim labelName
+			trim(labelName);
+			
+			//check if the label is valid
+			if(!(isNameValid(labelName))){
+				(io.error("invalid-name"))<<"invalid labelName \""<<labelName<<'"'<<std::endl;
+			}else{
+				auto iter_label=labelMap.find(labelName);
+				if(iter_label!=labelMap.end()){
+					(io.error("label-redefined"))<<"label \""<<labelName<<"\" is already defined (value="<<iter_label->second<<')'<<std::endl;
+				}else{
+					labelMap.insert(std::pair<std::string,content_type>(labelName,banks[currentBank].base+assembly.size()));
+					comment_label.emplace_back(ArenaString(labelName.data(),labelName.length()),assembly.size());
+					isThisAddressLabelled=true;
+					if(runOptions.isListing) crossReference.definitions[labelName]=io.currentLocation();
+#ifdef INFO_SHOW_LABEL_WHEN_PARSED
+					(io.info("label-value"))<<"label \""<<labelName<<"\" = "<<assembly.size()<<std::endl;
+#endif
+				}
+			}
+		}
+		if(lineStart>0) line.erase(0,lineStart);
+		
+		//operands as written
+		operandText.clear();
+		{
+			std::size_t nameStart=line.find_first_not_of(WHITESPACE);
+			if(nameStart!=std::string::npos){
+				std::size_t nameEnd=line.find_first_of(" \t,",nameStart);
+				if(nameEnd==std::string::npos) nameEnd=line.length();
+				operandText.assign(line,nameEnd,std::string::npos);
+				trim(operandText);
+				if((!(operandText.empty()))&&(operandText[0]==',')) operandText.erase(0,1);
+				
+				//expand macro
+				instr.assign(line,nameStart,nameEnd-nameStart);
+				auto iter_macro=macroMap.find(instr);
+				if(iter_macro!=macroMap.end()){
+					expandMacro(iter_macro->first,iter_macro->second,operandText,ppState);
+					continue;
+				}
+			}
+		}
+		
+		//separate fields
+		for(auto iter_comma=marks.commas.begin();iter_comma!=marks.commas.end();++iter_comma){
+			if((*iter_comma)>=lineStart) line[(*iter_comma)-lineStart]=' ';
+		}
+		
+		//trim this line
+		trim(line);
+		if(line.empty()) continue;
+		
+		//fields after the third one are appended to arg2
+		splitFields(line,instr,arg1,arg2);
+		toLowerCase(instr);
+		
+		if(instr==DIRECTIVE_EXPORT){
+			std::stringstream exportBuffer(line);
+			std::string labelName;
+			exportBuffer>>labelName;//the directive itself
+			while(exportBuffer>>labelName){
+				if(!(isNameValid(labelName))){
+					(io.error("invalid-name"))<<"invalid label name \""<<labelName<<"\" after "<<DIRECTIVE_EXPORT<<std::endl;
+				}else{
+					exportSet.insert(labelName);
+				}
+			}
+		}else if(instr==DIRECTIVE_BANK){
+			//"#bank NAME base depth [width]" starts a bank, "#bank NAME" continues it, "#bank" returns to default bank
+			std::stringstream bankBuffer(line);
+			std::string bankName;
+			std::vector<std::string> params;
+			bankBuffer>>bankName;//the directive itself
+			bankName.clear();
+			bankBuffer>>bankName;
+			std::string param;
+			while(bankBuffer>>param) params.push_back(param);
+			std::size_t index=1;
+			while((index<banks.size())&&(banks[index].name!=bankName)) ++index;
+			if(runOptions.isObjectOutput){
+				(io.error("bank-unsupported"))<<DIRECTIVE_BANK<<" is not supported in object output"<<std::endl;
+			}else if(bankName.empty()){
+				selectBank(0);
+			}else if(!(isNameValid(bankName))){
+				(io.error("invalid-name"))<<"invalid bank name \""<<bankName<<"\" after "<<DIRECTIVE_BANK<<std::endl;
+			}else if(params.empty()){
+				if(index==banks.size()){
+					(io.error("undefined-bank"))<<"bank \""<<bankName<<"\" is not defined (expecting "<<DIRECTIVE_BANK<<" name base depth [width])"<<std::endl;
+				}else{
+					selectBank(index);
+				}
+			}else if(index!=banks.size()){
+				(io.error("bank-redefined"))<<"bank \""<<bankName<<"\" is already defined"<<std::endl;
+			}else if(params.size()>3){
+				(io.error("invalid-operand"))<<"too many operands for "<<DIRECTIVE_BANK<<std::endl;
+			}else{
+				content_type values[3]={0,0,constantMap.at(OPTION_WIDTH)};
+				bool isValid=(params.size()>=2);
+				if(!isValid) (io.error("invalid-operand"))<<"expecting "<<DIRECTIVE_BANK<<" name base depth [width]"<<std::endl;
+				for(std::size_t i=0;isValid&&(i<params.size());++i){
+					offset_type offset=0;
+					std::string label;
+					if(!(convert2Value_Expression(params[i],values[i],offset,label)&&label.empty())){
+						(io.error("invalid-immediate"))<<"failed to interpret \""<<params[i]<<"\" as constant value"<<std::endl;
+						isValid=false;
+					}
+				}
+				if(isValid&&((values[1]==0)||(values[2]==0)||(values[2]>64))){
+					(io.error("invalid-operand"))<<"invalid depth or width for bank \""<<bankName<<"\""<<std::endl;
+					isValid=false;
+				}
+				for(auto iter_bank=banks.begin()+1;isValid&&(iter_bank!=banks.end());++iter_bank){
+					if((values[0]<iter_bank->base+iter_bank->depth)&&(iter_bank->base<values[0]+values[1])){
+						(io.error("bank-overlap"))<<"bank \""<<bankName<<"\" overlaps with bank \""<<iter_bank->name<<"\""<<std::endl;
+						isValid=false;
+					}
+				}
+				if(isValid){
+					banks.push_back(Bank());
+					banks.back().name=bankName;
+					banks.back().location=io.currentLocation();
+					banks.back().base=values[0];
+					banks.back().depth=values[1];
+					banks.back().width=values[2];
+					selectBank(banks.size()-1);
+				}
+			}
+		}else if(instr==INSTR_DEFINE_CONSTANT){
+			//check if the label is valid
+			if(isNameValid(arg1)){
+				auto iter_const=constantMap.find(arg1);
+				auto iter_option=optionVec.end();
+				if(deferredConstantMap.find(arg1)!=deferredConstantMap.end()){
+					(io.error("constant-redefined"))<<"constant \""<<arg1<<"\" is already defined"<<std::endl;
+				}else if(iter_const!=constantMap.end()){
+					for(iter_option=optionVec.begin();iter_option!=optionVec.end();++iter_option){
+						if(iter_option->first==arg1) break;
+					}
+					if(iter_option==optionVec.end()){
+						(io.error("constant-redefined"))<<"constant \""<<arg1<<"\" is already defined"<<std::endl;
+					}
+				}
+				if(((iter_const==constantMap.end())&&(deferredConstantMap.find(arg1)==deferredConstantMap.end()))||(iter_option!=optionVec.end())){
+					content_type value=0;
+					std::string label;
+					offset_type offset=0;
+					if(arg2.empty()){
+						//"#define NAME" without value (e.g. include guard) defines NAME as 1
+						value=1;
+					}
+					if((arg2.empty()||convert2Value_Expression(arg2,value,offset,label))&&label.empty()){
+						if(iter_option!=optionVec.end()){
+							//checked before the value is stored
+							bool isValid=true;
+							if((currentBank!=0)&&((iter_option->first==OPTION_WIDTH)||(iter_option->first==OPTION_IROffset))){
+								//a bank has the width given by #bank
+								(io.error("invalid-option"))<<"Option \""<<iter_option->first<<"\" applies to main memory and cannot be defined inside bank \""<<banks[currentBank].name<<'"'<<std::endl;
+								isValid=false;
+							}else if(iter_option->first==OPTION_WIDTH){
+								if(value<encoding.isa->irBits()){
+									(io.error("invalid-option"))<<"Specified width ("<<value<<") is too small"<<std::endl;
+									isValid=false;
+								}
+							}else if(iter_option->first==OPTION_IROffset){
+								if(static_cast<unsigned long long>(value)+encoding.isa->irBits()>constantMap.at(OPTION_WIDTH)){
+									(io.error("invalid-option"))<<"Specified IR offset ("<<value<<") leaves no room for IR ("<<encoding.isa->irBits()<<" bits) in width ("<<constantMap.at(OPTION_WIDTH)<<')'<<std::endl;
+									isValid=false;
+								}
+							}else if(iter_option->first==OPTION_ISA){
+								if(value>=ISA_COUNT){
+									(io.error("invalid-option"))<<"Specified instruction set ("<<value<<") does not exist"<<std::endl;
+									isValid=false;
+								}else if(constantMap.at(OPTION_WIDTH)<ISA_TABLE[value].irBits()){
+									(io.error("invalid-option"))<<"width ("<<constantMap.at(OPTION_WIDTH)<<") is too small for instruction set \""<<ISA_TABLE[value].name<<'"'<<std::endl;
+									isValid=false;
+								}
+							}
+							if(isValid){
+								constantMap.at(iter_option->first)=value;
+								if(runOptions.isListing) crossReference.definitions[arg1]=io.currentLocation();
+								if((!(assembly.empty()))){
+									(io.warning("late-option"))<<"Option \""<<iter_option->first<<"\" should be specified before instructions or data"<<std::endl;
+								}
+								//side effects
+								if(iter_option->first==OPTION_WIDTH){
+									constantMap.at(OPTION_IROffset)=value-encoding.isa->irBits();
+								}else if(iter_option->first==OPTION_ISA){
+									encoding.select(ISA_TABLE[value]);
+									constantMap.at(OPTION_IROffset)=constantMap.at(OPTION_WIDTH)-encoding.isa->irBits();
+								}
+								updateRightPadding();
+							}
+						}else{
+							constantMap.insert(std::pair<std::string,content_type>(arg1,value));
+							noteConstantDefined(arg1);
+							if(runOptions.isListing) crossReference.definitions[arg1]=io.currentLocation();
+#ifdef INFO_SHOW_CONSTANT_WHEN_PARSED
+							(io.info("constant-value"))<<"constant \""<<arg1<<"\" = "<<value<<std::endl;
+#endif
+							if(isThisAddressLabelled){
+								(io.warning("constant-after-label"))<<"constant definition after a label (do you want to hardcode it instead?)"<<std::endl;
+							}
+						}
+					}else if((iter_option==optionVec.end())&&hasNonConstantName(arg2)){
+						//uses constants defined later; evaluated when needed
+						DeferredConstant deferred;
+						deferred.expression=arg2;
+						deferred.location=io.currentLocation();
+						deferred.isEvaluating=false;
+						deferred.isFailed=false;
+						deferred.failedGeneration=0;
+						deferredConstantMap.insert(std::make_pair(arg1,deferred));
+						deferredConstantOrder.push_back(arg1);
+						noteConstantDefined(arg1);
+						if(runOptions.isListing) crossReference.definitions[arg1]=io.currentLocation();
+					}else{
+						(io.error("invalid-constant"))<<"constant \""<<arg1<<"\" has invalid expression (\""<<arg2<<"\")"<<std::endl;
+					}
+				}
+			}else{
+				(io.error("invalid-name"))<<"constant name \""<<arg1<<"\" is invalid"<<std::endl;
+			}
+		}else{
+			//instruction of the selected instruction set or directive
+			auto iter_instr=encoding.instructionMap.find(instr);
+			auto iter_directive=DIRECTIVE_MAP.end();
+			if(iter_instr==encoding.instructionMap.end()) iter_directive=DIRECTIVE_MAP.find(instr);
+			if((iter_instr==encoding.instructionMap.end())&&(iter_directive==DIRECTIVE_MAP.end())){
+				(io.error("invalid-mnemonic"))<<"invalid mnemonic \""<<instr<<'"'<<std::endl;
+			}else{
+				const InstructionDesc* desc=(iter_instr==encoding.instructionMap.end())?nullptr:iter_instr->second;
+				const content_type kind=(desc==nullptr)?iter_directive->second:desc->kind;
+				codeComment=instr;
+				codeComment+='\t';
+				codeComment+=arg1;
+				if(kind>=INSTR_DATA){
+					//data directives add comment for their own
+					codeComment.resize(instr.length()+1);
+				}else if(!(arg2.empty())){
+					codeComment+=",\t";
+					codeComment+=arg2;
+				}
+				if(kind<INSTR_DATA) comment_code.emplace_back(codeComment.data(),codeComment.length());
+				crossReference.isRecording=runOptions.isListing;
+				crossReference.address=assembly.size();//operands other than immediates (e.g. #fill count)
+				const bool isInstructionFit=(kind>=INSTR_DATA)||(currentWidth()>=encoding.isa->irBits());
+				if(!isInstructionFit){
+					(io.error("bank-too-narrow"))<<"width ("<<currentWidth()<<") of bank \""<<banks[currentBank].name<<"\" is too small for instructions of \""<<encoding.isa->name<<"\" (data only)"<<std::endl;
+				}
+				
+				switch(kind){
+					case INSTR_REG_REG:
+					{
+						//opcode followed by rx and ry
+						content_type rx=0;
+						content_type ry=0;
+						bool rxGood=convert2Reg(arg1,rx);
+						bool ryGood=convert2Reg(arg2,ry);
+						if(!isInstructionFit){
+							assembly.push_back(PADD_NOOP);
+						}else if(rxGood&&ryGood){
+							assembly.push_back(encoding.encode(*desc,rx,ry));
+						}else{
+							assembly.push_back(PADD_NOOP);
+							(io.error("invalid-register"))<<"failed to interpret \""<<arg1<<"\" or \""<<arg2<<"\" as register"<<std::endl;
+						}
+					}break;
+					case INSTR_REG_IMM:
+					{
+						//opcode followed by rx and immediate
+						comment_code.emplace_back();
+						content_type rx=0;
+						bool rxGood=convert2Reg(arg1,rx);
+						if(!isInstructionFit){
+							assembly.push_back(PADD_NOOP);
+							assembly.push_back(PADD_NOOP);
+						}else if(rxGood){
+							assembly.push_back(encoding.encode(*desc,rx,0));
+							assembly.push_back(PADD_NOOP);
+							if(!(setImmediate(arg2,assembly.size()-1,1))){
+								(io.error("invalid-immediate"))<<"failed to interpret \""<<arg2<<"\" as value"<<std::endl;
+							}
+						}else{
+							assembly.push_back(PADD_NOOP);
+							assembly.push_back(PADD_NOOP);
+							(io.error("invalid-register"))<<"failed to interpret \""<<arg1<<"\" as register"<<std::endl;
+						}
+					}break;
+					case INSTR_DATA:{
+						//one word for each comma separated value
+						std::vector<std::string> values=splitOperands(operandText);
+						for(auto iter_value=values.begin();iter_value!=values.end();++iter_value){
+							const std::string value=removeWhitespace(*iter_value);
+							appendDataWord(value,codeComment+value);
+						}
+					}break;
+					case INSTR_FILL:{
+						//#fill count,value
+						std::vector<std::string> operands=splitOperands(operandText);
+						content_type count=0;
+						offset_type offset=0;
+						std::string label;
+						codeComment+=operandText;
+						if((operands.size()!=2)||(!(convert2Value_Expression(removeWhitespace(operands[0]),count,offset,label)))||(!(label.empty()))){
+							(io.error("invalid-operand"))<<"expecting \"#fill count,value\" where count is a constant expression"<<std::endl;
+						}else if((count>0)&&isWithinMaxDepth(count,"#fill")){
+							const std::string valueText=removeWhitespace(operands[1]);
+							const std::size_t start=assembly.size();
+							assembly.resize(start+count,PADD_NOOP);
+							comment_code.resize(start+count);
+							comment_code[start].assign(codeComment.data(),codeComment.length());
+							if(!(setImmediate(valueText,start,count))){
+								(io.error("invalid-immediate"))<<"failed to interpret \""<<valueText<<"\" as immediate value"<<std::endl;
+							}
+						}
+					}break;
+					case INSTR_STRING:{
+						//#string "text"[,"text"...]
+						std::vector<std::string> operands=splitOperands(operandText);
+						std::string bytes;
+						for(auto iter_operand=operands.begin();iter_operand!=operands.end();++iter_operand){
+							std::string tmpBytes;
+							if(!(convert2String(*iter_operand,tmpBytes))){
+								(io.error("invalid-string"))<<"failed to interpret "<<(*iter_operand)<<" as string"<<std::endl;
+							}
+							bytes.append(tmpBytes);
+						}
+						appendBytes(reinterpret_cast<const unsigned char*>(bytes.data()),bytes.length(),codeComment+operandText);
+					}break;
+					case INSTR_INCBIN:{
+						//#incbin fileName[,offset,length]
+						std::vector<std::string> operands=splitOperands(operandText);
+						std::string fileName=operands.front();
+						if((fileName.length()>=2)&&(fileName.front()=='"')&&(fileName.back()=='"')){
+							fileName=fileName.substr(1,fileName.length()-2);
+						}
+						content_type fileOffset=0;
+						content_type length=0;
+						offset_type offset=0;
+						std::string label;
+						bool isLengthGiven=(operands.size()>2);
+						if((operands.size()==2)||(operands.size()>3)
+								||((operands.size()>1)&&((!(convert2Value_Expression(removeWhitespace(operands[1]),fileOffset,offset,label)))||(!(label.empty()))))
+								||(isLengthGiven&&((!(convert2Value_Expression(removeWhitespace(operands[2]),length,offset,label)))||(!(label.empty()))))){
+							(io.error("invalid-operand"))<<"expecting \"#incbin fileName[,offset,length]\" where offset and length are constant expressions"<<std::endl;
+							break;
+						}
+						const std::string path=io.resolvePath(fileName);
+						sourceFiles.push_back(path);
+						std::ifstream ifs(path,std::ios::binary);
+						if(!(ifs.good())){
+							(io.error("file-read-failed"))<<"failed to read from "<<path<<std::endl;
+							break;
+						}
+						ifs.seekg(0,std::ios::end);
+						const std::streamoff fileSize=ifs.tellg();
+						if(fileOffset>fileSize){
+							(io.error("invalid-operand"))<<"offset ("<<fileOffset<<") is beyond the end of "<<path<<" (size="<<fileSize<<')'<<std::endl;
+							break;
+						}
+						if((!isLengthGiven)||(fileOffset+static_cast<std::streamoff>(length)>fileSize)){
+							if(isLengthGiven) (io.warning("incbin-truncated"))<<"only "<<(fileSize-fileOffset)<<" byte(s) are available in "<<path<<std::endl;
+							length=fileSize-fileOffset;
+						}
+						if(!(isWithinMaxDepth((static_cast<unsigned long long>(length)+bytesPerDataWord()-1)/bytesPerDataWord(),"#incbin"))) break;
+						//read in one go
+						std::vector<unsigned char> bytes(length);
+						ifs.seekg(fileOffset);
+						ifs.read(reinterpret_cast<char*>(bytes.data()),length);
+						appendBytes(bytes.data(),bytes.size(),codeComment+operandText);
+					}break;
+					default:{
+						assembly.push_back(PADD_NOOP);
+						comment_code.emplace_back(codeComment.data(),codeComment.length());
+						(io.error("internal-error"))<<"opcode handling unimplemented"<<std::endl;
+					}break;
+				}
+				crossReference.isRecording=false;
+				isThisAddressLabelled=false;
+			}
+		}
+	}
+	io.sourceLine=nullptr;
+	resolveDeferred();
+	if(ppState.isDefiningMacro){
+		(io.error("unterminated-macro",IOManager::NoLineCount))<<"EOF reached; definition of macro \""<<ppState.macroName<<"\" is not terminated by #endmacro"<<std::endl;
+	}
+	if(!(ppState.conditionals.empty())){
+		(io.error("unterminated-conditional",IOManager::NoLineCount))<<"EOF reached; "<<ppState.conditionals.size()<<" #if block(s) not terminated by #endif"<<std::endl;
+	}
+	if(isThisAddressLabelled){
+		(io.warning("dangling-label",IOManager::NoLineCount))<<"EOF reached; the last label is not labeling any defined content"<<std::endl;
+	}
+	
+}
+
+//parameters of output derived from options after the first pass
+struct OutputFormat{
+	unsigned depth;
+	unsigned width;
+	unsigned address_width;//number of hex digits for address
+	unsigned data_width;//number of hex digits for data
+	unsigned long long assembly_mask;
+	bool isAddressNeedAdjustment;
+	bool isOffsetNeedAdjustment;
+};
+
+//format of the memory being assembled (default bank or one from #bank)
+OutputFormat getOutputFormat(){
+	OutputFormat format;
+	format.depth=(currentBank==0)?constantMap.at(OPTION_DEPTH):banks[currentBank].depth;
+	format.width=currentWidth();
+	format.isAddressNeedAdjustment=(constantMap.at(OPTION_IsByteAddressing)!=0);
+	format.isOffsetNeedAdjustment=format.isAddressNeedAdjustment&&(constantMap.at(OPTION_IsOffsetCorrectionNeeded));
+	
+	if(assembly.size()>format.depth){
+		std::ostream& warningDest=(io.warning("depth-overflow",IOManager::NoLineCount));
+		warningDest<<std::dec<<"size of assembly ("<<std::dec<<assembly.size()<<") is greater than depth ("<<format.depth<<") can store!";
+		if(currentBank!=0) warningDest<<" (bank \""<<banks[currentBank].name<<"\")";
+		warningDest<<std::endl;
+		while(format.depth<assembly.size()) format.depth<<=1;
+		(io.info("depth-overflow",IOManager::NoLineCount))<<"depth changed to "<<format.depth<<std::endl;
+	}
+	format.address_width=1;
+	unsigned tmp_depth=format.depth;
+	while(tmp_depth>16){
+		++format.address_width;
+		tmp_depth>>=4;
+	}
+	format.data_width=(format.width-1)/4+1;
+	format.assembly_mask=(format.width<64)?((1ULL<<format.width)-1):0;
+	if(format.assembly_mask==0){//when unsigned long long is not long enough
+		format.assembly_mask=-1;
+	}
+	return format;
+}
+
+//second pass: write label addresses into all pending immediates
+void resolveLabels(const OutputFormat& format){
+	const unsigned depth=format.depth;
+	const unsigned width=format.width;
+	const unsigned address_width=format.address_width;
+	const unsigned data_width=format.data_width;
+	const bool isAddressNeedAdjustment=format.isAddressNeedAdjustment;
+	const bool isOffsetNeedAdjustment=format.isOffsetNeedAdjustment;
+	//labels may refer to main memory when resolving a named bank
+	const unsigned long long mainDepth=(currentBank==0)?depth:constantMap.at(OPTION_DEPTH);
+	
+	//start to resolve labels
+	for(auto iter=pendingLabelMap.begin();iter!=pendingLabelMap.end();++iter){
+		auto iter_label=labelMap.find(iter->first);
+		if(iter_label==labelMap.end()){
+			std::ostream& errorDest=(io.error("undefined-label",IOManager::NoLineCount));
+			errorDest<<"when resolving labels: label \""<<iter->first<<"\" is not found\n\tNote: This label is evaluated at following (word) address:\n"<<std::hex;
+			for(auto iter_victim=iter->second.begin();iter_victim!=iter->second.end();++iter_victim){
+				errorDest<<"\t0x"<<(iter_victim->first);
+			}
+			errorDest<<std::endl;
+		}else{
+			//word size of the memory holding the label
+			const unsigned long long labelBytesPerWord=bytesPerWordAt(iter_label->second);
+			content_type labelBaseAddress=iter_label->second;
+			if(isAddressNeedAdjustment) labelBaseAddress*=labelBytesPerWord;
+			for(auto iter_eval=iter->second.begin();iter_eval!=iter->second.end();++iter_eval){
+				offset_type offset=iter_eval->second;
+				if(isOffsetNeedAdjustment) offset*=labelBytesPerWord;
+				assembly[iter_eval->first]=labelBaseAddress+offset;
+				if(isAddressNeedAdjustment){
+					if(!(isMappedAddress(assembly[iter_eval->first],mainDepth,true))){
+						(io.warning("address-out-of-range",IOManager::NoLineCount))<<std::setfill('0')
+								<<"expression with label at (word) address 0x"<<std::hex<<std::nouppercase<<std::setw(address_width)<<iter_eval->first
+								<<" evaluates to (byte address) 0x"<<std::setw(data_width)<<assembly[iter_eval->first]<<std::dec
+								<<", which is not in address range of this memory (0 - 0x"<<std::setw(address_width)<<(depth*width/8)-1<<')'
+								<<std::dec<<std::endl;
+					}
+					if(offset%(width/8)!=0){
+						(io.warning("unaligned-offset",IOManager::NoLineCount))<<std::setfill('0')
+								<<"expression with label at (word) address 0x"<<std::hex<<std::nouppercase<<std::setw(address_width)<<iter_eval->first
+								<<" has unaligned offset ("<<offset<<')'<<std::endl;
+					}
+				}else{
+					if(!(isMappedAddress(assembly[iter_eval->first],mainDepth,false))){
+						(io.warning("address-out-of-range",IOManager::NoLineCount))<<std::setfill('0')
+								<<"expression with label at address 0x"<<std::hex<<std::nouppercase<<std::setw(address_width)<<iter_eval->first
+								<<" evaluates to 0x"<<std::setw(data_width)<<assembly[iter_eval->first]
+								<<", which is not in address range of this memory (0 - 0x"<<std::setw(address_width)<<depth-1<<')'
+								<<std::dec<<std::endl;
+					}
+				}
+			}
+		}
+	}
+	//expressions with more than label+offset: each one is evaluated once for all words using it
+	for(auto iter_reloc=expressionRelocations.begin();iter_reloc!=expressionRelocations.end();++iter_reloc){
+		RelocatableExpression& expression=relocatableExpressions[iter_reloc->expression];
+		if(evaluateRelocatableExpression(expression,isAddressNeedAdjustment)) assembly[iter_reloc->address]=static_cast<content_type>(expression.value);
+	}
+}
+
+//write mif file of one memory (labels are [labelName,index in words], sorted by index)
+void writeMif(std::ostream& outputDest, const OutputFormat& format, const std::vector<unsigned long long>& words, const std::vector<ArenaString>& comments, const LabelComments& labels){
+	const unsigned depth=format.depth;
+	const unsigned width=format.width;
+	const unsigned address_width=format.address_width;
+	const unsigned data_width=format.data_width;
+	const unsigned long long assembly_mask=format.assembly_mask;
+	
+	//output constants and labels
+	if(runOptions.isSymbolTableWritten){
+		outputDest<<"-- Constants: "<<constantMap.size()<<" in total\n";
+		for(auto iter_tmp=constantMap.begin();iter_tmp!=constantMap.end();++iter_tmp){
+			outputDest<<"--\t"<<iter_tmp->first<<'\t'<<std::dec<<iter_tmp->second<<"\t0x"<<std::hex<<std::nouppercase<<iter_tmp->second<<'\n';
+		}
+		//labels are already sorted by increasing address
+		outputDest<<"-- Labels: "<<labels.size()<<" in total\n";
+		for(auto iter_tmp=labels.begin();iter_tmp!=labels.end();++iter_tmp){
+			outputDest<<"--\t"<<iter_tmp->first<<"\t0x"<<std::hex<<std::nouppercase<<iter_tmp->second<<'\n';
+		}
+		outputDest<<'\n'<<std::dec;
+	}
+	
+	outputDest<<"DEPTH = "<<depth
+			<<";\nWIDTH = "<<width
+			<<";\nADDRESS_RADIX = HEX;\nDATA_RADIX = HEX;\nCONTENT\nBEGIN\n";
+	
+	outputDest<<std::hex<<std::setfill('0')<<std::uppercase;
+	//bool isOversizeNotReported=true;
+	auto iter_labelComment=labels.begin();
+	for(std::size_t i=0;i<words.size();++i){
+		while((iter_labelComment!=labels.end())&&(iter_labelComment->second==i)){
+			outputDest<<"-- Label \""<<iter_labelComment->first<<"\":\n";
+			++iter_labelComment;
+		}
+		const unsigned long long content=assembly_mask&(words[i]);
+		std::size_t runEnd=i;
+#ifdef OUTPUT_MERGE_REPEATED_WORDS
+		//a run stops before next label or comment
+		const std::size_t nextLabelAddress=(iter_labelComment==labels.end())?words.size():iter_labelComment->second;
+		while((runEnd+1<nextLabelAddress)&&(runEnd+1<words.size())&&(comments[runEnd+1].empty())&&((assembly_mask&(words[runEnd+1]))==content)){
+			++runEnd;
+		}
+		//runs shorter than 3 words are not merged, so that mvi and its immediate are never merged
+		if(runEnd-i<2) runEnd=i;
+#endif
+		if(runEnd==i){
+			outputDest<<std::setw(address_width)<<i<<"\t:\t"<<std::setw(data_width)<<content<<';';
+		}else{
+			outputDest<<'['<<std::setw(address_width)<<i<<".."<<std::setw(address_width)<<runEnd<<"]\t:\t"<<std::setw(data_width)<<content<<';';
+		}
+		if(!(comments[i].empty())){
+			outputDest<<"\t-- "<<comments[i];
+		}
+		outputDest<<'\n';
+		i=runEnd;
+	}
+#ifdef OUTPUT_ZERO_FILL
+	if((depth-words.size())==1){
+		outputDest<<std::setw(address_width)<<words.size()<<"\t:\t"<<std::setw(data_width)<<PADD_NOOP<<";\n";
+	}else if((depth-words.size())>1){
+		outputDest<<'['<<std::setw(address_width)<<words.size()<<".."<<std::setw(address_width)<<depth-1<<"]\t:\t"<<std::setw(data_width)<<PADD_NOOP<<";\n";
+	}
+#endif
+	outputDest<<"END;"<<std::endl;
+}
+
+//object file: result of first pass of one module, in text (one record per line, numbers in decimal)
+//	ECE342OBJ <version>
+//	OPTION <name> <value>					value of each option
+//	CONST <name> <value>					constants (for symbol table only)
+//	WORD <value>[<tab><comment>]			content of next address
+//	LABEL <name> <address> <isExported>		address is relative to start of module
+//	RELOC <label> <address> <offset>		content at address is label+offset
+//	SYMBOL <name> <expression>				constant depending on labels (after the ones it uses)
+//	EXPR <address> <expression>				content at address is expression of labels and SYMBOL constants
+//	END
+const std::string OBJECT_MAGIC="ECE342OBJ";
+constexpr unsigned OBJECT_VERSION=1;
+
+void writeObject(std::ostream& dest){
+	dest<<OBJECT_MAGIC<<' '<<OBJECT_VERSION<<'\n'<<std::dec;
+	for(auto iter_option=optionVec.begin();iter_option!=optionVec.end();++iter_option){
+		dest<<"OPTION "<<iter_option->first<<' '<<constantMap.at(iter_option->first)<<'\n';
+	}
+	for(auto iter_const=constantMap.begin();iter_const!=constantMap.end();++iter_const){
+		auto iter_option=optionVec.begin();
+		while((iter_option!=optionVec.end())&&(iter_option->first!=iter_const->first)) ++iter_option;
+		if(iter_option==optionVec.end()){
+			dest<<"CONST "<<iter_const->first<<' '<<iter_const->second<<'\n';
+		}
+	}
+	for(std::size_t i=0;i<assembly.size();++i){
+		dest<<"WORD "<<assembly[i];
+		if(!(comment_code[i].empty())) dest<<'\t'<<comment_code[i];
+		dest<<'\n';
+	}
+	for(auto iter_label=comment_label.begin();iter_label!=comment_label.end();++iter_label){
+		dest<<"LABEL "<<iter_label->first<<' '<<iter_label->second<<' '<<exportSet.count(std::string(iter_label->first.data(),iter_label->first.length()))<<'\n';
+	}
+	for(auto iter_export=exportSet.begin();iter_export!=exportSet.end();++iter_export){
+		if(labelMap.find(*iter_export)==labelMap.end()){
+			(io.error("undefined-export",IOManager::NoLineCount))<<"exported label \""<<(*iter_export)<<"\" is not defined"<<std::endl;
+		}
+	}
+	for(auto iter=pendingLabelMap.begin();iter!=pendingLabelMap.end();++iter){
+		for(auto iter_eval=iter->second.begin();iter_eval!=iter->second.end();++iter_eval){
+			dest<<"RELOC "<<iter->first<<' '<<iter_eval->first<<' '<<iter_eval->second<<'\n';
+		}
+	}
+	std::vector<std::pair<std::size_t,std::string>> symbols;//by index of expression, so that used ones come first
+	for(auto iter_symbolic=symbolicConstantMap.begin();iter_symbolic!=symbolicConstantMap.end();++iter_symbolic){
+		symbols.push_back(std::make_pair(iter_symbolic->second.expression,iter_symbolic->first));
+	}
+	std::sort(symbols.begin(),symbols.end());
+	for(auto iter_symbol=symbols.begin();iter_symbol!=symbols.end();++iter_symbol){
+		dest<<"SYMBOL "<<iter_symbol->second<<' '<<relocatableExpressions[iter_symbol->first].text<<'\n';
+	}
+	for(auto iter_reloc=expressionRelocations.begin();iter_reloc!=expressionRelocations.end();++iter_reloc){
+		dest<<"EXPR "<<iter_reloc->address<<' '<<relocatableExpressions[iter_reloc->expression].text<<'\n';
+	}
+	dest<<"END"<<std::endl;
+}
+
+//append one object file to assembly; labels not exported are renamed so that they are only visible in this module
+bool loadObject(const std::string& objectName, unsigned moduleIndex){
+	std::ifstream ifs(objectName);
+	if(!(ifs.good())){
+		(io.error("file-read-failed",IOManager::NoLineCount))<<"failed to read from "<<objectName<<std::endl;
+		return false;
+	}
+	const content_type base=assembly.size();
+	const std::string localSuffix='@'+std::to_string(moduleIndex);
+	std::unordered_set<std::string> localNames;//labels not exported and constants (renamed with localSuffix)
+	std::vector<std::pair<std::string,std::pair<content_type,offset_type>>> relocations;
+	std::vector<std::pair<content_type,std::string>> expressions;
+	std::vector<std::pair<std::string,std::string>> symbols;//name and expression
+	const std::size_t labelCount=comment_label.size();
+	std::vector<std::string> definedLabels;//names inserted into labelMap
+	//undo a partly read module
+	auto rollback=[&](){
+		assembly.resize(base);
+		comment_code.resize(base);
+		comment_label.resize(labelCount);
+		for(auto iter_name=definedLabels.begin();iter_name!=definedLabels.end();++iter_name){
+			labelMap.erase(*iter_name);
+		}
+	};
+	bool isEndSeen=false;
+	std::string line;
+	unsigned lineCount=0;
+	while((!isEndSeen)&&std::getline(ifs,line)){
+		++lineCount;
+		if((!(line.empty()))&&(line.back()=='\r')) line.pop_back();
+		if(line.empty()) continue;
+		std::stringstream buf(line);
+		std::string record;
+		buf>>record;
+		if(lineCount==1){
+			unsigned version=0;
+			buf>>version;
+			if((record!=OBJECT_MAGIC)||(version!=OBJECT_VERSION)){
+				(io.error("invalid-object",IOManager::NoLineCount))<<'"'<<objectName<<"\" is not an object file of version "<<OBJECT_VERSION<<std::endl;
+				rollback();
+				return false;
+			}
+		}else if(record=="OPTION"){
+			std::string name;
+			content_type value=0;
+			buf>>name>>value;
+			auto iter_option=constantMap.find(name);
+			if((!(buf.fail()))&&(iter_option!=constantMap.end())){
+				if(moduleIndex==0){
+					iter_option->second=value;
+				}else if(name==OPTION_DEPTH){
+					if(value>iter_option->second) iter_option->second=value;
+				}else if(iter_option->second!=value){
+					(io.error("option-mismatch",IOManager::NoLineCount))<<"in object \""<<objectName<<"\": option \""<<name<<"\" ("<<value<<") differs from the first module ("<<iter_option->second<<')'<<std::endl;
+				}
+			}
+		}else if(record=="CONST"){
+			std::string name;
+			content_type value=0;
+			buf>>name>>value;
+			if(!(buf.fail())) constantMap.insert(std::pair<std::string,content_type>(name,value));
+		}else if(record=="WORD"){
+			unsigned long long value=0;
+			buf>>value;
+			std::size_t commentStart=line.find('\t');
+			assembly.push_back(value);
+			comment_code.emplace_back();
+			if(commentStart!=std::string::npos) comment_code.back().assign(line.data()+commentStart+1,line.length()-commentStart-1);
+		}else if(record=="LABEL"){
+			std::string name;
+			content_type address=0;
+			unsigned isExported=0;
+			buf>>name>>address>>isExported;
+			if(!(buf.fail())){
+				comment_label.emplace_back(ArenaString(name.data(),name.length()),base+address);
+				if(isExported!=0){
+					auto iter_label=labelMap.find(name);
+					if(iter_label!=labelMap.end()){
+						(io.error("label-redefined",IOManager::NoLineCount))<<"in object \""<<objectName<<"\": exported label \""<<name<<"\" is already defined (value="<<iter_label->second<<')'<<std::endl;
+					}else{
+						labelMap.insert(std::pair<std::string,content_type>(name,base+address));
+						definedLabels.push_back(name);
+					}
+				}else{
+					localNames.insert(name);
+					labelMap.insert(std::pair<std::string,content_type>(name+localSuffix,base+address));
+					definedLabels.push_back(name+localSuffix);
+				}
+			}
+		}else if(record=="RELOC"){
+			std::string name;
+			content_type address=0;
+			offset_type offset=0;
+			buf>>name>>address>>offset;
+			relocations.push_back(std::make_pair(name,std::make_pair(address,offset)));
+		}else if(record=="SYMBOL"){
+			std::string name;
+			std::string expression;
+			buf>>name>>expression;
+			symbols.push_back(std::make_pair(name,expression));
+		}else if(record=="EXPR"){
+			content_type address=0;
+			std::string expression;
+			buf>>address>>expression;
+			expressions.push_back(std::make_pair(address,expression));
+		}else if(record=="END"){
+			isEndSeen=true;
+		}else{
+			buf.setstate(std::ios::failbit);
+		}
+		if(buf.fail()){
+			(io.error("invalid-object",IOManager::NoLineCount))<<"in object \""<<objectName<<"\": malformed record at line "<<lineCount<<std::endl;
+			rollback();
+			return false;
+		}
+	}
+	if(!isEndSeen){
+		(io.error("invalid-object",IOManager::NoLineCount))<<"in object \""<<objectName<<"\": unexpected end of file"<<std::endl;
+		rollback();
+		return false;
+	}
+	//labels defined in this module are preferred
+	for(auto iter_reloc=relocations.begin();iter_reloc!=relocations.end();++iter_reloc){
+		if(base+iter_reloc->second.first>=assembly.size()){
+			(io.error("invalid-object",IOManager::NoLineCount))<<"in object \""<<objectName<<"\": relocation address "<<iter_reloc->second.first<<" is out of range"<<std::endl;
+			continue;
+		}
+		std::string labelName=iter_reloc->first;
+		if(localNames.count(labelName)!=0) labelName.append(localSuffix);
+		pendingLabelMap[labelName].push_back(std::pair<content_type,offset_type>(base+iter_reloc->second.first,iter_reloc->second.second));
+	}
+	//rename local labels and constants (the text has no other constants)
+	for(auto iter_symbol=symbols.begin();iter_symbol!=symbols.end();++iter_symbol){
+		localNames.insert(iter_symbol->first);
+	}
+	auto localize=[&localNames,&localSuffix](const std::string& text)->std::string{
+		std::string expression;
+		std::size_t nameStart=0;
+		for(std::size_t i=0;i<=text.length();++i){
+			if((i==text.length())||(EXPRESSION_OPERATORS.find(text[i])!=std::string::npos)){
+				const std::string name=text.substr(nameStart,i-nameStart);
+				expression.append(name);
+				if(localNames.count(name)!=0) expression.append(localSuffix);
+				if(i<text.length()) expression.push_back(text[i]);
+				nameStart=i+1;
+			}
+		}
+		return expression;
+	};
+	for(auto iter_symbol=symbols.begin();iter_symbol!=symbols.end();++iter_symbol){
+		std::vector<RelocationTerm> terms;
+		std::string text;
+		if(!(compileExpression(localize(iter_symbol->second),terms,text))){
+			(io.error("invalid-object",IOManager::NoLineCount))<<"in object \""<<objectName<<"\": invalid expression \""<<iter_symbol->second<<'"'<<std::endl;
+			continue;
+		}
+		SymbolicConstant symbolic;
+		symbolic.expression=addRelocatableExpression(text,terms,SourceLocation());
+		symbolicConstantMap.insert(std::make_pair(iter_symbol->first+localSuffix,symbolic));
+	}
+	for(auto iter_expr=expressions.begin();iter_expr!=expressions.end();++iter_expr){
+		if(base+iter_expr->first>=assembly.size()){
+			(io.error("invalid-object",IOManager::NoLineCount))<<"in object \""<<objectName<<"\": relocation address "<<iter_expr->first<<" is out of range"<<std::endl;
+			continue;
+		}
+		if(!(addExpressionRelocation(localize(iter_expr->second),base+iter_expr->first,1,SourceLocation()))){
+			(io.error("invalid-object",IOManager::NoLineCount))<<"in object \""<<objectName<<"\": invalid expression \""<<iter_expr->second<<'"'<<std::endl;
+		}
+	}
+	return true;
+}
+
+//image read from mif file; words not specified are zero
+struct MifImage{
+	unsigned depth;
+	unsigned width;
+	std::vector<unsigned long long> words;
+	std::vector<std::pair<std::string,content_type>> labels;//from "-- Label" comments written by writeMif()
+	
+	MifImage():depth(0),width(0){}
+};
+
+//cursor over the whole content of a mif file
+class MifParser{
+private:
+	const char* cur;
+	const char* end;
+	unsigned addressRadix;
+	unsigned dataRadix;
+	std::vector<std::string> pendingLabels;//labels for next address
+	
+	void skipSpaceAndComments(){
+		static const std::string labelPrefix="-- Label \"";
+		while(cur<end){
+			if((*cur==' ')||(*cur=='\t')||(*cur=='\r')||(*cur=='\n')){
+				++cur;
+			}else if((*cur=='-')&&(cur+1<end)&&(cur[1]=='-')){
+				const char* commentStart=cur;
+				while((cur<end)&&(*cur!='\n')) ++cur;
+				if((static_cast<std::size_t>(cur-commentStart)>labelPrefix.length())&&(std::equal(labelPrefix.begin(),labelPrefix.end(),commentStart))){
+					const char* nameStart=commentStart+labelPrefix.length();
+					const char* nameEnd=std::find(nameStart,cur,'"');
+					if(nameEnd!=cur) pendingLabels.push_back(std::string(nameStart,nameEnd));
+				}
+			}else if(*cur=='%'){
+				++cur;
+				while((cur<end)&&(*cur!='%')) ++cur;
+				if(cur<end) ++cur;
+			}else{
+				break;
+			}
+		}
+	}
+	
+	std::string readWord(){
+		skipSpaceAndComments();
+		const char* wordStart=cur;
+		while((cur<end)&&(std::isalnum(static_cast<unsigned char>(*cur))||(*cur=='_'))) ++cur;
+		return getLowerCase(std::string(wordStart,cur));
+	}
+	
+	bool expect(char c){
+		skipSpaceAndComments();
+		if((cur<end)&&(*cur==c)){
+			++cur;
+			return true;
+		}
+		return false;
+	}
+	
+	static bool convertRadix(const std::string& name, unsigned& radix){
+		if(name=="hex"){
+			radix=16;
+		}else if((name=="dec")||(name=="uns")){
+			radix=10;
+		}else if(name=="oct"){
+			radix=8;
+		}else if(name=="bin"){
+			radix=2;
+		}else{
+			return false;
+		}
+		return true;
+	}
+	
+	bool readNumber(unsigned radix, unsigned long long& value){
+		skipSpaceAndComments();
+		bool isNegative=false;
+		if((cur<end)&&(*cur=='-')&&(radix==10)){
+			isNegative=true;
+			++cur;
+		}
+		const char* numberStart=cur;
+		value=0;
+		while(cur<end){
+			unsigned digit=radix;
+			const char c=*cur;
+			if((c>='0')&&(c<='9')){
+				digit=c-'0';
+			}else if((c>='A')&&(c<='F')){
+				digit=c-'A'+10;
+			}else if((c>='a')&&(c<='f')){
+				digit=c-'a'+10;
+			}
+			if(digit>=radix) break;
+			value=value*radix+digit;
+			++cur;
+		}
+		if(isNegative) value=0-value;
+		return cur!=numberStart;
+	}
+	
+public:
+	MifParser(const std::string& content):
+			cur(content.data()),
+			end(content.data()+content.length()),
+			addressRadix(16),
+			dataRadix(16){
+	}
+	
+	//return false on syntax error; image.words has depth entries on success
+	bool parse(MifImage& image){
+		//header
+		while(true){
+			std::string key=readWord();
+			if(key=="content"){
+				if(readWord()!="begin") return false;
+				break;
+			}
+			if(key.empty()||(!expect('='))) return false;
+			if((key=="address_radix")||(key=="data_radix")){
+				if(!(convertRadix(readWord(),(key=="data_radix")?dataRadix:addressRadix))) return false;
+			}else{
+				unsigned long long value=0;
+				if(!(readNumber(10,value))) return false;
+				if(key=="depth"){
+					if(value>MIF_MAX_DEPTH) return false;
+					image.depth=value;
+				}else if(key=="width"){
+					if(value>MIF_MAX_WIDTH){
+						image.width=MIF_MAX_WIDTH+1;//reported by parseMif()
+						return false;
+					}
+					image.width=value;
+				}
+			}
+			if(!expect(';')) return false;
+		}
+		image.words.assign(image.depth,0);
+		
+		//content
+		while(true){
+			skipSpaceAndComments();
+			if((cur<end)&&((*cur=='E')||(*cur=='e'))){
+				return readWord()=="end";
+			}
+			unsigned long long first=0;
+			unsigned long long last=0;
+			bool isRange=expect('[');
+			if(!(readNumber(addressRadix,first))) return false;
+			last=first;
+			if(isRange){
+				if((!expect('.'))||(!expect('.'))||(!(readNumber(addressRadix,last)))||(!expect(']'))) return false;
+				if(first>last) return false;
+			}
+			if(!expect(':')) return false;
+			for(auto iter_label=pendingLabels.begin();iter_label!=pendingLabels.end();++iter_label){
+				image.labels.push_back(std::make_pair(*iter_label,static_cast<content_type>(first)));
+			}
+			pendingLabels.clear();
+			//a range gets one value; a single address can be followed by values of next addresses
+			unsigned long long address=first;
+			unsigned long long value=0;
+			while(readNumber(dataRadix,value)){
+				if(isRange){
+					if(last>=image.words.size()) return false;
+					std::fill(image.words.begin()+first,image.words.begin()+last+1,value);
+				}else{
+					if(address>=image.words.size()) return false;
+					image.words[address++]=value;
+				}
+			}
+			if(!expect(';')) return false;
+		}
+	}
+};
+
+bool readFile(const std::string& fileName, std::string& content){
+	std::ifstream ifs(fileName,std::ios::binary);
+	if(!(ifs.good())) return false;
+	std::ostringstream buf;
+	buf<<ifs.rdbuf();
+	content=buf.str();
+	return true;
+}
+
+//binary image / patch: words in little endian, (width+7)/8 bytes each
+void writeWordBinary(std::ostream& dest, unsigned long long value, unsigned bytesPerWord){
+	for(unsigned i=0;i<bytesPerWord;++i){
+		dest.put(static_cast<char>((i<sizeof(value))?((value>>(8*i))&0xff):0));
+	}
+}
+
+//parse content of mif file fileName; report the reason on failure
+bool parseMif(const std::string& content, const std::string& fileName, MifImage& image){
+	if(MifParser(content).parse(image)) return true;
+	if(image.width>MIF_MAX_WIDTH){
+		(io.error("invalid-mif",IOManager::NoLineCount))<<"width of \""<<fileName<<"\" is greater than "<<MIF_MAX_WIDTH<<" bits"<<std::endl;
+	}else{
+		(io.error("invalid-mif",IOManager::NoLineCount))<<'"'<<fileName<<"\" is not a valid mif file"<<std::endl;
+	}
+	return false;
+}
+
+//read previous image: mif if fileName ends with ".mif", otherwise binary image of given width
+bool readImage(const std::string& fileName, unsigned width, MifImage& image){
+	std::string content;
+	if(!(readFile(fileName,content))){
+		(io.error("file-read-failed",IOManager::NoLineCount))<<"failed to read from "<<fileName<<std::endl;
+		return false;
+	}
+	if((fileName.length()>=4)&&(getLowerCase(fileName.substr(fileName.length()-4))==".mif")){
+		if(!(parseMif(content,fileName,image))) return false;
+		return true;
+	}
+	const unsigned bytesPerWord=(width+7)/8;
+	image.width=width;
+	image.depth=content.length()/bytesPerWord;
+	image.words.assign(image.depth,0);
+	const unsigned char* data=reinterpret_cast<const unsigned char*>(content.data());
+	for(std::size_t i=0;i<image.depth;++i){
+		unsigned long long value=0;
+		for(unsigned j=0;(j<bytesPerWord)&&(j<sizeof(value));++j){
+			value|=static_cast<unsigned long long>(data[i*bytesPerWord+j])<<(8*j);
+		}
+		image.words[i]=value;
+	}
+	return true;
+}
+
+//binary patch:
+//	"M342PTCH", width (u32), number of ranges (u32),
+//	then for each range: start address (u32), number of words (u32), words
+//all integers are little endian
+const std::string PATCH_MAGIC="M342PTCH";
+
+//compare assembly with previous image and write only the changed address ranges
+void writeDelta(const OutputFormat& format){
+	MifImage previous;
+	if(!(readImage(runOptions.deltaBaseFileName,format.width,previous))) return;
+	if((previous.width!=0)&&(previous.width!=format.width)){
+		(io.warning("delta-width-mismatch",IOManager::NoLineCount))<<"width of previous image ("<<previous.width<<") differs from current one ("<<format.width<<')'<<std::endl;
+	}
+	
+	//both images are compared in the same (masked, zero filled) form
+	const std::size_t size=std::max<std::size_t>(format.depth,previous.words.size());
+	std::vector<unsigned long long> current(size,PADD_NOOP);
+	for(std::size_t i=0;i<assembly.size();++i){
+		current[i]=format.assembly_mask&assembly[i];
+	}
+	previous.words.resize(size,PADD_NOOP);
+	for(std::size_t i=0;i<size;++i){
+		previous.words[i]&=format.assembly_mask;
+	}
+	
+	//skip identical blocks with memcmp (vectorized by the library), then find exact ranges
+	constexpr std::size_t BLOCK_SIZE=64;
+	std::vector<std::pair<std::size_t,std::size_t>> ranges;//[begin,end)
+	for(std::size_t blockStart=0;blockStart<size;blockStart+=BLOCK_SIZE){
+		const std::size_t blockEnd=std::min(size,blockStart+BLOCK_SIZE);
+		if(std::memcmp(current.data()+blockStart,previous.words.data()+blockStart,(blockEnd-blockStart)*sizeof(unsigned long long))==0) continue;
+		for(std::size_t i=blockStart;i<blockEnd;++i){
+			if(current[i]==previous.words[i]) continue;
+			if((!(ranges.empty()))&&(ranges.back().second==i)){
+				ranges.back().second=i+1;
+			}else{
+				ranges.push_back(std::make_pair(i,i+1));
+			}
+		}
+	}
+	
+	const std::string mifName=runOptions.outputBaseName+".patch.mif";
+	const std::string binName=runOptions.outputBaseName+".patch.bin";
+	std::ofstream mifDest(mifName);
+	std::ofstream binDest(binName,std::ios::binary);
+	if(!(mifDest.good())){
+		(io.error("file-write-failed",IOManager::NoLineCount))<<"failed to write to "<<mifName<<std::endl;
+		return;
+	}
+	if(!(binDest.good())){
+		(io.error("file-write-failed",IOManager::NoLineCount))<<"failed to write to "<<binName<<std::endl;
+		return;
+	}
+	
+	//mif with changed addresses only
+	mifDest<<"DEPTH = "<<format.depth
+			<<";\nWIDTH = "<<format.width
+			<<";\nADDRESS_RADIX = HEX;\nDATA_RADIX = HEX;\nCONTENT\nBEGIN\n";
+	mifDest<<std::hex<<std::setfill('0')<<std::uppercase;
+	for(auto iter_range=ranges.begin();iter_range!=ranges.end();++iter_range){
+		std::size_t i=iter_range->first;
+		while(i<iter_range->second){
+			std::size_t runEnd=i;
+			while((runEnd+1<iter_range->second)&&(current[runEnd+1]==current[i])) ++runEnd;
+			if(runEnd==i){
+				mifDest<<std::setw(format.address_width)<<i<<"\t:\t"<<std::setw(format.data_width)<<current[i]<<";\n";
+			}else{
+				mifDest<<'['<<std::setw(format.address_width)<<i<<".."<<std::setw(format.address_width)<<runEnd<<"]\t:\t"<<std::setw(format.data_width)<<current[i]<<";\n";
+			}
+			i=runEnd+1;
+		}
+	}
+	mifDest<<"END;"<<std::endl;
+	
+	//binary patch
+	const unsigned bytesPerWord=(format.width+7)/8;
+	binDest.write(PATCH_MAGIC.data(),PATCH_MAGIC.length());
+	writeWordBinary(binDest,format.width,4);
+	writeWordBinary(binDest,ranges.size(),4);
+	for(auto iter_range=ranges.begin();iter_range!=ranges.end();++iter_range){
+		writeWordBinary(binDest,iter_range->first,4);
+		writeWordBinary(binDest,iter_range->second-iter_range->first,4);
+		for(std::size_t i=iter_range->first;i<iter_range->second;++i){
+			writeWordBinary(binDest,current[i],bytesPerWord);
+		}
+	}
+	
+	//summary of changed words for each label (words before the first label are counted as "<start>")
+	std::size_t changedCount=0;
+	std::vector<std::size_t> changedPerLabel(comment_label.size()+1,0);
+	for(auto iter_range=ranges.begin();iter_range!=ranges.end();++iter_range){
+		changedCount+=iter_range->second-iter_range->first;
+		for(std::size_t i=iter_range->first;i<iter_range->second;++i){
+			auto iter_label=std::upper_bound(comment_label.begin(),comment_label.end(),i,
+					[](std::size_t address,const LabelComments::value_type& label){return address<label.second;});
+			++changedPerLabel[iter_label-comment_label.begin()];
+		}
+	}
+	(io.info("delta-summary",IOManager::NoLineCount))<<changedCount<<" word(s) in "<<ranges.size()<<" range(s) changed; patch written to "<<mifName<<" and "<<binName<<std::endl;
+	for(std::size_t i=0;i<changedPerLabel.size();++i){
+		if(changedPerLabel[i]==0) continue;
+		(io.info("delta-summary",IOManager::NoLineCount))<<changedPerLabel[i]<<" word(s) changed under label \""<<((i==0)?"<start>":comment_label[i-1].first.c_str())<<'"'<<std::endl;
+	}
+}
+
+//append value as "0x..." in upper case hex
+void appendHex(std::string& dest, unsigned long long value){
+	static const char hexDigits[]="0123456789ABCDEF";
+	char buf[2+2*sizeof(value)];
+	std::size_t length=0;
+	do{
+		buf[length++]=hexDigits[value&0xf];
+		value>>=4;
+	}while(value!=0);
+	dest.append("0x");
+	while(length>0) dest.push_back(buf[--length]);
+}
+
+//labels from a mif written by this program or from an object file
+bool readSymbols(const std::string& fileName, std::vector<std::pair<std::string,content_type>>& labels){
+	std::string content;
+	if(!(readFile(fileName,content))){
+		(io.error("file-read-failed",IOManager::NoLineCount))<<"failed to read from "<<fileName<<std::endl;
+		return false;
+	}
+	if((fileName.length()>=4)&&(getLowerCase(fileName.substr(fileName.length()-4))==".mif")){
+		MifImage image;
+		if(!(parseMif(content,fileName,image))) return false;
+		labels.insert(labels.end(),image.labels.begin(),image.labels.end());
+		return true;
+	}
+	std::stringstream buf(content);
+	std::string line;
+	while(std::getline(buf,line)){
+		std::stringstream lineBuffer(line);
+		std::string record;
+		std::string name;
+		content_type address=0;
+		lineBuffer>>record>>name>>address;
+		if((record=="LABEL")&&(!(lineBuffer.fail()))) labels.push_back(std::make_pair(name,address));
+	}
+	return true;
+}
+
+//convert mif back to source; words are decoded with the default encoding for WIDTH in the mif
+int disassemble(const std::string& mifFileName){
+	std::string content;
+	MifImage image;
+	if(!(readFile(mifFileName,content))){
+		(io.error("file-read-failed",IOManager::NoLineCount))<<"failed to read from "<<mifFileName<<std::endl;
+	}else if(!(parseMif(content,mifFileName,image))){
+		//reported by parseMif()
+	}else if(image.width<ISA_TABLE[runOptions.isaIndex].irBits()){
+		(io.error("invalid-mif",IOManager::NoLineCount))<<"width of \""<<mifFileName<<"\" ("<<image.width<<") is too small for instructions"<<std::endl;
+	}else{
+		content.clear();
+		//every label is written once: local labels of linked modules may repeat a name in the mif (renamed),
+		//and a label in both the mif and the symbol file is taken from the mif
+		std::vector<std::pair<std::string,content_type>> labels;
+		std::unordered_map<std::string,content_type> labelAddresses;
+		for(auto iter_label=image.labels.begin();iter_label!=image.labels.end();++iter_label){
+			std::string name=iter_label->first;
+			auto iter_address=labelAddresses.find(name);
+			if((iter_address!=labelAddresses.end())&&(iter_address->second==iter_label->second)) continue;
+			for(unsigned suffix=2;labelAddresses.find(name)!=labelAddresses.end();++suffix){
+				name=iter_label->first+'_'+std::to_string(suffix);
+			}
+			labelAddresses.insert(std::make_pair(name,iter_label->second));
+			labels.push_back(std::make_pair(name,iter_label->second));
+		}
+		if(!(runOptions.symbolFileName.empty())){
+			std::vector<std::pair<std::string,content_type>> symbols;
+			readSymbols(runOptions.symbolFileName,symbols);
+			for(auto iter_symbol=symbols.begin();iter_symbol!=symbols.end();++iter_symbol){
+				auto result=labelAddresses.insert(*iter_symbol);
+				if(result.second){
+					labels.push_back(*iter_symbol);
+				}else if(result.first->second!=iter_symbol->second){
+					(io.warning("label-conflict",IOManager::NoLineCount))<<std::hex<<"label \""<<iter_symbol->first<<"\" is at 0x"<<result.first->second
+							<<" in the mif but at 0x"<<iter_symbol->second<<" in "<<runOptions.symbolFileName<<"; the one in the mif is used"<<std::dec<<std::endl;
+				}
+			}
+		}
+		std::stable_sort(labels.begin(),labels.end(),
+				[](const std::pair<std::string,content_type>& lhs,const std::pair<std::string,content_type>& rhs){return lhs.second<rhs.second;});
+		std::unordered_map<
+				content_type,	//address
+				std::string		//first label at this address
+		> addressLabelMap;
+		for(auto iter_label=labels.begin();iter_label!=labels.end();++iter_label){
+			addressLabelMap.insert(std::make_pair(iter_label->second,iter_label->first));
+		}
+		encoding.select(ISA_TABLE[runOptions.isaIndex]);
+		const IsaDesc& isa=*(encoding.isa);
+		const unsigned rightPadding=image.width-isa.irBits();
+		const unsigned long long paddingMask=(1ULL<<rightPadding)-1;
+		const content_type registerMask=(1u<<isa.registerBits)-1;
+		
+		//trailing zeros are restored by zero fill
+		std::size_t size=image.words.size();
+		while((size>0)&&(image.words[size-1]==PADD_NOOP)) --size;
+		if((!(labels.empty()))&&(labels.back().second>=size)) size=std::min<std::size_t>(labels.back().second+1,image.words.size());
+		
+		std::string out;
+		out.reserve(size*24);
+		out.append("// disassembled from ").append(mifFileName).append("\n");
+		out.append(INSTR_DEFINE_CONSTANT).append(" ").append(OPTION_DEPTH).append(" ").append(std::to_string(image.depth)).append("\n");
+		out.append(INSTR_DEFINE_CONSTANT).append(" ").append(OPTION_WIDTH).append(" ").append(std::to_string(image.width)).append("\n");
+		if(runOptions.isaIndex!=0) out.append(INSTR_DEFINE_CONSTANT).append(" ").append(OPTION_ISA).append(" ").append(std::to_string(runOptions.isaIndex)).append("\n");
+		auto iter_label=labels.begin();
+		std::size_t i=0;
+		while(i<size){
+			while((iter_label!=labels.end())&&(iter_label->second<=i)){
+				if(iter_label->second==i) out.append(iter_label->first).append(":\n");
+				++iter_label;
+			}
+			const std::size_t nextLabelAddress=(iter_label==labels.end())?size:std::min<std::size_t>(size,iter_label->second);
+			const unsigned long long word=image.words[i];
+			
+			//runs of identical words
+			std::size_t runEnd=i;
+			while((runEnd+1<nextLabelAddress)&&(image.words[runEnd+1]==word)) ++runEnd;
+			if(runEnd-i>=2){
+				out.append("\t#fill\t").append(std::to_string(runEnd-i+1)).append(",");
+				appendHex(out,word);
+				out.push_back('\n');
+				i=runEnd+1;
+				continue;
+			}
+			
+			const content_type opcode=(word>>(rightPadding+2*isa.registerBits))&((1u<<isa.opcodeBits)-1);
+			const content_type rx=(word>>(rightPadding+isa.registerBits))&registerMask;
+			const content_type ry=(word>>rightPadding)&registerMask;
+			const InstructionDesc* desc=encoding.opcodeTable[opcode];
+			const bool isInstruction=((word&paddingMask)==0)&&((word>>(rightPadding+isa.irBits()))==0)&&(desc!=nullptr);
+			if(isInstruction&&(desc->kind==INSTR_REG_IMM)&&(ry==0)&&(i+1<nextLabelAddress)){
+				//the immediate is shown as label if there is one at that address
+				const unsigned long long immediate=image.words[i+1];
+				out.append("\t").append(desc->mnemonic).append("\tr").append(std::to_string(rx)).append(",\t");
+				auto iter_name=addressLabelMap.find(static_cast<content_type>(immediate));
+				if((immediate<=static_cast<content_type>(-1))&&(iter_name!=addressLabelMap.end())){
+					out.append(iter_name->second);
+				}else{
+					appendHex(out,immediate);
+				}
+				out.push_back('\n');
+				i+=2;
+			}else if(isInstruction&&(desc->kind==INSTR_REG_REG)){
+				out.append("\t").append(desc->mnemonic).append("\tr").append(std::to_string(rx)).append(",\tr").append(std::to_string(ry)).append("\n");
+				++i;
+			}else{
+				out.append("\t#data\t");
+				appendHex(out,word);
+				out.push_back('\n');
+				++i;
+			}
+		}
+		io.output().write(out.data(),out.length());
+		io.output().flush();
+	}
+	io.flushDiagnostics();
+	return 0;
+}
+
+//listing: address, content and source line side by side, followed by symbols with their definition and uses
+void writeListing(const OutputFormat& format){
+	const std::string listingName=runOptions.outputBaseName+".lst";
+	std::ofstream dest(listingName);
+	if(!(dest.good())){
+		(io.error("file-write-failed",IOManager::NoLineCount))<<"failed to write to "<<listingName<<std::endl;
+		return;
+	}
+	const unsigned address_width=format.address_width;
+	const unsigned data_width=format.data_width;
+	const std::vector<ListingLine>& lines=crossReference.lines;
+	
+	dest<<std::hex<<std::setfill('0')<<std::uppercase;
+	for(std::size_t lineIndex=0;lineIndex<lines.size();++lineIndex){
+		const ListingLine& listingLine=lines[lineIndex];
+		const std::size_t wordEnd=(lineIndex+1<lines.size())?lines[lineIndex+1].address:assembly.size();
+		std::size_t i=listingLine.address;
+		if(i==wordEnd){
+			//no content (label, constant, ...)
+			dest<<std::setw(address_width)<<i<<'\t'<<std::string(data_width,' ');
+		}
+		while(i<wordEnd){
+			const unsigned long long content=format.assembly_mask&assembly[i];
+			std::size_t runEnd=i;
+			while((runEnd+1<wordEnd)&&((format.assembly_mask&assembly[runEnd+1])==content)) ++runEnd;
+			if(runEnd-i<2) runEnd=i;
+			if(i!=listingLine.address) dest<<'\n';
+			if(runEnd==i){
+				dest<<std::setw(address_width)<<i;
+			}else{
+				dest<<'['<<std::setw(address_width)<<i<<".."<<std::setw(address_width)<<runEnd<<']';
+			}
+			dest<<'\t'<<std::setw(data_width)<<content;
+			if(i==listingLine.address){
+				dest<<'\t';
+				listingLine.location.print(dest);
+				dest<<'\t'<<listingLine.text;
+			}
+			i=runEnd+1;
+		}
+		if(listingLine.address==wordEnd){
+			dest<<'\t';
+			listingLine.location.print(dest);
+			dest<<'\t'<<listingLine.text;
+		}
+		dest<<'\n';
+	}
+	
+	//cross reference, sorted by name
+	std::vector<std::string> names;
+	names.reserve(labelMap.size()+constantMap.size());
+	for(auto iter_label=labelMap.begin();iter_label!=labelMap.end();++iter_label){
+		names.push_back(iter_label->first);
+	}
+	for(auto iter_const=constantMap.begin();iter_const!=constantMap.end();++iter_const){
+		if(labelMap.find(iter_const->first)==labelMap.end()) names.push_back(iter_const->first);
+	}
+	for(auto iter_symbolic=symbolicConstantMap.begin();iter_symbolic!=symbolicConstantMap.end();++iter_symbolic){
+		names.push_back(iter_symbolic->first);
+	}
+	std::sort(names.begin(),names.end());
+	//labels used by each expression, including those of the constants it uses (which come first)
+	std::vector<std::vector<std::string>> expressionLabels(relocatableExpressions.size());
+	for(std::size_t i=0;i<relocatableExpressions.size();++i){
+		std::vector<std::string>& labels=expressionLabels[i];
+		const std::vector<RelocationTerm>& terms=relocatableExpressions[i].terms;
+		for(auto iter_term=terms.begin();iter_term!=terms.end();++iter_term){
+			if(iter_term->kind==TERM_NAME){
+				labels.push_back(iter_term->name);
+			}else if(iter_term->kind==TERM_EXPRESSION){
+				const std::vector<std::string>& used=expressionLabels[iter_term->value];
+				labels.insert(labels.end(),used.begin(),used.end());
+			}
+		}
+		std::sort(labels.begin(),labels.end());
+		labels.erase(std::unique(labels.begin(),labels.end()),labels.end());
+	}
+	//labels used by expression relocations
+	std::unordered_map<std::string,std::vector<content_type>> expressionUses;
+	for(auto iter_reloc=expressionRelocations.begin();iter_reloc!=expressionRelocations.end();++iter_reloc){
+		const std::vector<std::string>& labels=expressionLabels[iter_reloc->expression];
+		for(auto iter_label=labels.begin();iter_label!=labels.end();++iter_label){
+			expressionUses[*iter_label].push_back(iter_reloc->address);
+		}
+	}
+	dest<<"\nSymbols: "<<std::dec<<names.size()<<" in total\n";
+	dest<<"Name\tKind\tValue\tDefinition\tReferenced at\n"<<std::hex;
+	std::vector<content_type> useAddresses;
+	for(auto iter_name=names.begin();iter_name!=names.end();++iter_name){
+		const std::vector<content_type>* uses=nullptr;
+		auto iter_label=labelMap.find(*iter_name);
+		if(iter_label!=labelMap.end()){
+			dest<<(*iter_name)<<"\tlabel\t0x"<<std::setw(address_width)<<iter_label->second<<'\t';
+			auto iter_pend=pendingLabelMap.find(*iter_name);
+			auto iter_expr=expressionUses.find(*iter_name);
+			useAddresses.clear();
+			if(iter_pend!=pendingLabelMap.end()){
+				for(auto iter_eval=iter_pend->second.begin();iter_eval!=iter_pend->second.end();++iter_eval){
+					useAddresses.push_back(iter_eval->first);
+				}
+			}
+			if(iter_expr!=expressionUses.end()){
+				useAddresses.insert(useAddresses.end(),iter_expr->second.begin(),iter_expr->second.end());
+			}
+			//uses evaluated at the end of the first pass are appended out of order
+			std::sort(useAddresses.begin(),useAddresses.end());
+			useAddresses.erase(std::unique(useAddresses.begin(),useAddresses.end()),useAddresses.end());
+			if(!(useAddresses.empty())) uses=&useAddresses;
+		}else if(symbolicConstantMap.find(*iter_name)!=symbolicConstantMap.end()){
+			//substituted into the expressions using it
+			dest<<(*iter_name)<<"\texpression\t"<<relocatableExpressions[symbolicConstantMap.at(*iter_name).expression].text<<'\t';
+		}else{
+			const content_type value=constantMap.at(*iter_name);
+			dest<<(*iter_name)<<"\tconstant\t0x"<<value<<'\t';
+			auto iter_use=crossReference.constantUses.find(*iter_name);
+			if(iter_use!=crossReference.constantUses.end()){
+				//uses evaluated at the end of the first pass are appended out of order
+				useAddresses.assign(iter_use->second.begin(),iter_use->second.end());
+				std::sort(useAddresses.begin(),useAddresses.end());
+				useAddresses.erase(std::unique(useAddresses.begin(),useAddresses.end()),useAddresses.end());
+				uses=&useAddresses;
+			}
+		}
+		auto iter_definition=crossReference.definitions.find(*iter_name);
+		if(iter_definition!=crossReference.definitions.end()){
+			iter_definition->second.print(dest);
+		}else{
+			dest<<"(default)";
+		}
+		dest<<'\t';
+		if(uses!=nullptr){
+			for(auto iter_use=uses->begin();iter_use!=uses->end();++iter_use){
+				dest<<((iter_use==uses->begin())?"":" ")<<std::setw(address_width)<<(*iter_use);
+			}
+		}
+		dest<<'\n';
+	}
+}
+
+//pipelined mode: one thread reads source in blocks, main thread assembles, one thread writes output
+//blocks are handed over by bounded queues (threads sleep while waiting); an empty block marks the end
+template<typename T, std::size_t Capacity>
+class BoundedQueue{
+private:
+	T slots[Capacity];
+	std::size_t head;//number of items popped
+	std::size_t tail;//number of items pushed
+	std::mutex mutex;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+	
+public:
+	BoundedQueue():head(0),tail(0){}
+	
+	//wait if full
+	void push(T&& value){
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock,[this](){return tail-head<Capacity;});
+		slots[tail%Capacity]=std::move(value);
+		++tail;
+		lock.unlock();
+		notEmpty.notify_one();
+	}
+	
+	//wait if empty
+	void pop(T& value){
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock,[this](){return tail!=head;});
+		value=std::move(slots[head%Capacity]);
+		++head;
+		lock.unlock();
+		notFull.notify_one();
+	}
+};
+
+//istream buffer filled by a reader thread
+class PipedInputBuffer: public std::streambuf{
+private:
+	std::istream& source;
+	BoundedQueue<std::string,PIPE_QUEUE_LENGTH> queue;
+	std::string current;//block being consumed
+	bool isEnd;
+	std::thread reader;
+	
+	void readAll(){
+		while(true){
+			std::string block(PIPE_BLOCK_SIZE,'\0');
+			source.read(&block[0],block.size());
+			block.resize(source.gcount());
+			const bool isLast=block.empty();
+			queue.push(std::move(block));
+			if(isLast) return;
+		}
+	}
+	
+protected:
+	int_type underflow()override{
+		if(gptr()<egptr()) return traits_type::to_int_type(*gptr());
+		if(isEnd) return traits_type::eof();
+		queue.pop(current);
+		if(current.empty()){
+			isEnd=true;
+			return traits_type::eof();
+		}
+		setg(&current[0],&current[0],&current[0]+current.size());
+		return traits_type::to_int_type(*gptr());
+	}
+	
+public:
+	explicit PipedInputBuffer(std::istream& src):source(src),isEnd(false){
+		reader=std::thread(&PipedInputBuffer::readAll,this);
+	}
+	
+	~PipedInputBuffer(){
+		//reader thread only stops at the end of source
+		while(!isEnd){
+			queue.pop(current);
+			isEnd=current.empty();
+		}
+		reader.join();
+	}
+};
+
+//ostream buffer drained by a writer thread
+class PipedOutputBuffer: public std::streambuf{
+private:
+	std::ostream& dest;
+	BoundedQueue<std::string,PIPE_QUEUE_LENGTH> queue;
+	std::string current;//block being filled
+	std::thread writer;
+	
+	void writeAll(){
+		std::string block;
+		while(true){
+			queue.pop(block);
+			if(block.empty()) break;
+			dest.write(block.data(),block.size());
+		}
+		dest.flush();
+	}
+	
+	void startBlock(){
+		current.assign(PIPE_BLOCK_SIZE,'\0');
+		setp(&current[0],&current[0]+current.size());
+	}
+	
+	void handOver(){
+		const std::size_t length=pptr()-pbase();
+		if(length==0) return;
+		current.resize(length);
+		queue.push(std::move(current));
+		startBlock();
+	}
+	
+protected:
+	int_type overflow(int_type c)override{
+		handOver();
+		if(!(traits_type::eq_int_type(c,traits_type::eof()))){
+			*pptr()=traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+	
+	int sync()override{
+		handOver();
+		return 0;
+	}
+	
+public:
+	explicit PipedOutputBuffer(std::ostream& dst):dest(dst){
+		startBlock();
+		writer=std::thread(&PipedOutputBuffer::writeAll,this);
+	}
+	
+	~PipedOutputBuffer(){
+		handOver();
+		queue.push(std::string());
+		writer.join();
+	}
+};
+
+//redirect source and output of io through the threads while alive
+class Pipeline{
+private:
+	PipedInputBuffer inputBuffer;
+	std::istream input;
+	PipedOutputBuffer outputBuffer;
+	std::ostream output;
+	std::ostream* originalOutput;
+	
+public:
+	Pipeline():
+			inputBuffer(*io.inputSrc),
+			input(&inputBuffer),
+			outputBuffer(*io.outputDest),
+			output(&outputBuffer),
+			originalOutput(io.outputDest){
+		io.inputSrc=&input;
+		io.outputDest=&output;
+	}
+	
+	~Pipeline(){
+		output.flush();
+		io.outputDest=originalOutput;
+	}
+};
+
+//named banks must start after main memory, whose depth is only known after assembly (it may still change or grow)
+void checkBankOverlap(unsigned mainDepth){
+	for(auto iter_bank=banks.begin()+1;iter_bank!=banks.end();++iter_bank){
+		if(iter_bank->base<mainDepth){
+			(io.error("bank-overlap",iter_bank->location))<<"bank \""<<iter_bank->name<<"\" overlaps with main memory (0 - "<<(mainDepth-1)<<')'<<std::endl;
+		}
+	}
+}
+
+//writes images of named banks (<outputBaseName>.<name>.mif), one thread per bank, while the main output is written
+class BankWriters{
+private:
+	std::vector<std::unique_ptr<std::ofstream>> files;
+	std::vector<std::thread> threads;
+	
+public:
+	//resolve labels of each named bank (on this thread) and start its writer
+	void start(){
+		for(std::size_t i=1;i<banks.size();++i){
+			selectBank(i);
+			const OutputFormat format=getOutputFormat();
+			resolveLabels(format);
+			selectBank(0);
+			const std::string fileName=runOptions.outputBaseName+'.'+banks[i].name+".mif";
+			files.emplace_back(new std::ofstream(fileName));
+			if(!(files.back()->good())){
+				(io.error("file-write-failed",IOManager::NoLineCount))<<"failed to open bank output file "<<fileName<<std::endl;
+				continue;
+			}
+			std::ofstream* dest=files.back().get();
+			const Bank* bank=&banks[i];
+			threads.emplace_back([dest,format,bank](){
+				writeMif(*dest,format,bank->assembly,bank->comment_code,bank->comment_label);
+				dest->flush();
+			});
+		}
 	}
-	if((!(operatorStack.empty()))||(operandStack.size()!=1)){
-		//(io.warning())<<"Debug: stack is not as expected at end of execution"<<std::endl;
-		return false;
-	}else{
-		if(tmplabel.empty()){
-			result=static_cast<content_type>(operandStack.back());
-		}else{
-			label.swap(tmplabel);
-			offset=operandStack.back();
+	
+	~BankWriters(){
+		for(auto iter_thread=threads.begin();iter_thread!=threads.end();++iter_thread){
+			iter_thread->join();
 		}
-		return true;
 	}
+};
+
+//allocations from the run arena so far
+void reportStats(){
+	(io.info("stats",IOManager::NoLineCount))<<"arena: "<<runArena.allocationCount<<" allocation(s), "<<runArena.allocationBytes<<" byte(s) in "<<runArena.chunkCount()<<" chunk(s); "
+			<<runArena.largeAllocationCount<<" large allocation(s), "<<runArena.largeAllocationBytes<<" byte(s) from heap"<<std::endl;
+	//see Arena for what is (not) allocated from it
+	(io.info("stats",IOManager::NoLineCount))<<"arena covers symbol tables, label relocations, word comments and label names; long table keys, words, expressions and source lines use the heap"<<std::endl;
 }
 
-//function that does main job
-int process(unsigned depth,unsigned width){
-	for(auto iter_option=optionVec.begin();iter_option!=optionVec.end();++iter_option){
-		constantMap.insert((*iter_option));
+//build cache (-cache dir): one file per source and options, named by their hash
+//	ECE342CACHE <version>
+//	FILE <hash> <path>				file read by #include / #incbin ('-' as hash if it could not be read)
+//	OUTPUT <length>					followed by content of mif / object file
+//	DIAGNOSTICS <length>			followed by messages (see IOManager::saveDiagnostics())
+//an entry is used only if every FILE still has the same hash
+//entries are written to a temporary file and renamed, so parallel runs never see a partial entry
+const std::string CACHE_MAGIC="ECE342CACHE";
+constexpr unsigned CACHE_VERSION=2;
+
+//FNV-1a
+constexpr unsigned long long HASH_OFFSET_BASIS=14695981039346656037ULL;
+constexpr unsigned long long HASH_PRIME=1099511628211ULL;
+
+unsigned long long hashBytes(const std::string& data, unsigned long long hash=HASH_OFFSET_BASIS){
+	for(std::size_t i=0;i<data.length();++i){
+		hash^=static_cast<unsigned char>(data[i]);
+		hash*=HASH_PRIME;
 	}
-	assembly.reserve(depth);
-	comment_code.reserve(depth);
+	return hash;
+}
+
+class BuildCache{
+private:
+	bool isEnabled;
+	std::string entryName;
+	std::istringstream source;//source is read at once to compute the key
+	std::ostringstream capturedOutput;
+	std::ostream* finalOutput;
 	
-	//warning if a label is labeling a non-instruction (constants definition)
-	bool isThisAddressLabelled=false;
+	static std::string toHex(unsigned long long value){
+		std::ostringstream buf;
+		buf<<std::hex<<std::setfill('0')<<std::setw(16)<<value;
+		return buf.str();
+	}
 	
-	while(io.input_good()){
-		std::string line;
-		io.input_getline(line);
-		if(line.back()=='\n') line.pop_back();
-		if(line.back()=='\r') line.pop_back();
-		
-		//ignore comment
-		std::size_t comment_start=line.find("//");
-		if(comment_start!=std::string::npos) line.resize(comment_start);
-		
-		//find if any labels are defined here
-		std::size_t label_end=line.find(':');
-		while(label_end!=std::string::npos){
-			std::string labelName=line.substr(0,label_end);
-			line.erase(0,label_end+1);//remove the ':' as well
-			
-			//trim labelName
-			trim(labelName);
-			
-			//check if the label is valid
-			if(!(isNameValid(labelName))){
-				(io.error())<<"invalid labelName \""<<labelName<<'"'<<std::endl;
-			}else{
-				auto iter_label=labelMap.find(labelName);
-				if(iter_label!=labelMap.end()){
-					(io.error())<<"label \""<<labelName<<"\" is already defined (value="<<iter_label->second<<')'<<std::endl;
-				}else{
-					const std::pair<std::string,content_type> tmpPair(labelName,assembly.size());
-					labelMap.insert(tmpPair);
-					comment_label.push_back(tmpPair);
-					isThisAddressLabelled=true;
-#ifdef INFO_SHOW_LABEL_WHEN_PARSED
-					(io.info())<<"label \""<<labelName<<"\" = "<<assembly.size()<<std::endl;
-#endif
-				}
-			}
-			//find next one, if any
-			label_end=line.find(':');
-		}
-		
-		//separate fields
-		for(std::size_t i=0;i<line.length();++i){
-			if(line[i]==',') line[i]=' ';
-		}
-		
-		//trim this line
-		trim(line);
-		if(line.empty()) continue;
-		
-		std::stringstream lineBuffer(line);
-		std::string instr;
-		std::string arg1;
-		std::string arg2;
-		std::string shouldBeEmpty;
-		lineBuffer>>instr>>arg1>>arg2>>shouldBeEmpty;
-		instr=getLowerCase(instr);
-		
-		/*
-		if(!(shouldBeEmpty.empty())){
-			(io.warning())<<"everything after \""<<arg2<<"\" is ignored"<<std::endl;
-		}
-		*/
-		while(!(shouldBeEmpty.empty())){
-			arg2.append(shouldBeEmpty);
-			shouldBeEmpty.clear();
-			lineBuffer>>shouldBeEmpty;
-		}
-		
-		if(instr==INSTR_DEFINE_CONSTANT){
-			//check if the label is valid
-			if(isNameValid(arg1)){
-				auto iter_const=constantMap.find(arg1);
-				auto iter_option=optionVec.end();
-				if(iter_const!=constantMap.end()){
-					for(iter_option=optionVec.begin();iter_option!=optionVec.end();++iter_option){
-						if(iter_option->first==arg1) break;
-					}
-					if(iter_option==optionVec.end()){
-						(io.error())<<"constant \""<<arg1<<"\" is already defined"<<std::endl;
-					}
-				}
-				if((iter_const==constantMap.end())||(iter_option!=optionVec.end())){
-					content_type value=0;
-					std::string label;
-					offset_type offset=0;
-					if(convert2Value_Expression(arg2,value,offset,label)&&label.empty()){
-						if(iter_option!=optionVec.end()){
-							constantMap.at(iter_option->first)=value;
-							if((!(assembly.empty()))){
-								(io.warning())<<"Option \""<<iter_option->first<<"\" should be specified before instructions or data"<<std::endl;
-							}
-							//side effects
-							if(iter_option->first==OPTION_WIDTH){
-								if(value<9){
-									(io.error())<<"Specified width ("<<value<<") is too small"<<std::endl;
-								}else{
-									constantMap.at(OPTION_IROffset)=value-9;
-									OFFSET_RIGHT_PADDING=value-9;
-									OFFSET_OPCODE=OFFSET_RIGHT_PADDING+6;
-									OFFSET_RX=OFFSET_RIGHT_PADDING+3;
-									OFFSET_RY=OFFSET_RIGHT_PADDING;
-								}
-							}else if(iter_option->first==OPTION_IROffset){
-								OFFSET_RIGHT_PADDING=value;
-								OFFSET_OPCODE=OFFSET_RIGHT_PADDING+6;
-								OFFSET_RX=OFFSET_RIGHT_PADDING+3;
-								OFFSET_RY=OFFSET_RIGHT_PADDING;
-							}
-						}else{
-							constantMap.insert(std::pair<std::string,content_type>(arg1,value));
-#ifdef INFO_SHOW_CONSTANT_WHEN_PARSED
-							(io.info())<<"constant \""<<arg1<<"\" = "<<value<<std::endl;
-#endif
-							if(isThisAddressLabelled){
-								(io.warning())<<"constant definition after a label (do you want to hardcode it instead?)"<<std::endl;
-							}
-						}
-					}else{
-						(io.error())<<"constant \""<<arg1<<"\" has invalid expression (\""<<arg2<<"\")"<<std::endl;
-					}
+	static std::string hashFile(const std::string& path){
+		std::string content;
+		return readFile(path,content)?toHex(hashBytes(content)):std::string("-");
+	}
+	
+	//check entry; write output and restore messages if it is valid
+	bool load(){
+		std::string content;
+		if(!(readFile(entryName,content))) return false;
+		std::istringstream src(content);
+		std::string magic;
+		unsigned version=0;
+		src>>magic>>version;
+		if((magic!=CACHE_MAGIC)||(version!=CACHE_VERSION)) return false;
+		std::string record;
+		std::string output;
+		std::string diagnostics;
+		while(src>>record){
+			if(record=="FILE"){
+				std::string hash;
+				std::string path;
+				src>>hash;
+				src.ignore(1);
+				std::getline(src,path);
+				if(hashFile(path)!=hash) return false;
+			}else if((record=="OUTPUT")||(record=="DIAGNOSTICS")){
+				std::size_t length=0;
+				src>>length;
+				src.ignore(1);
+				std::string& dest=(record=="OUTPUT")?output:diagnostics;
+				dest.resize(length);
+				if(length>0) src.read(&dest[0],length);
+				if(src.fail()) return false;
+				if(record=="DIAGNOSTICS"){
+					if(!(io.restoreDiagnostics(diagnostics))) return false;
+					io.output().write(output.data(),output.length());
+					io.output().flush();
+					return true;
 				}
 			}else{
-				(io.error())<<"constant name \""<<arg1<<"\" is invalid"<<std::endl;
-			}
-		}else{
-			auto iter_instr=OPCODE_MAP.find(instr);
-			if(iter_instr==OPCODE_MAP.end()){
-				(io.error())<<"invalid mnemonic \""<<instr<<'"'<<std::endl;
-			}else{
-				std::string codeComment=instr;
-				codeComment+='\t';
-				codeComment+=arg1;
-				if(iter_instr->second==INSTR_DATA){
-					codeComment+=arg2;
-				}else if(!(arg2.empty())){
-					codeComment+=",\t";
-					codeComment+=arg2;
-				}
-				comment_code.push_back(codeComment);
-				
-				switch(iter_instr->second){
-					case INSTR_MV:
-					case INSTR_ADD:
-					case INSTR_SUB:
-					case INSTR_LD:
-					case INSTR_ST:
-					case INSTR_MVNZ:
-					{
-						//opcode followed by rx and ry
-						content_type rx=0;
-						content_type ry=0;
-						bool rxGood=convert2Reg(arg1,rx);
-						bool ryGood=convert2Reg(arg2,ry);
-						if(rxGood&&ryGood){
-							unsigned long long content=((iter_instr->second)<<OFFSET_OPCODE)
-														+(rx<<OFFSET_RX)
-														+(ry<<OFFSET_RY);
-							assembly.push_back(content);
-						}else{
-							assembly.push_back(PADD_NOOP);
-							(io.error())<<"failed to interpret \""<<arg1<<"\" or \""<<arg2<<"\" as register"<<std::endl;
-						}
-					}break;
-					case INSTR_MVI:
-					{
-						//opcode followed by rx and immediate
-						comment_code.push_back(std::string());
-						content_type rx=0;
-						content_type immediate=0;
-						offset_type offset=0;
-						std::string label;
-						bool rxGood=convert2Reg(arg1,rx);
-						bool immGood=convert2Value_Expression(arg2,immediate,offset,label);
-						if(rxGood){
-							unsigned long long content=((iter_instr->second)<<OFFSET_OPCODE)
-														+(rx<<OFFSET_RX);
-							assembly.push_back(content);
-							assembly.push_back(immediate);
-							if(!immGood){
-								(io.error())<<"failed to interpret \""<<arg2<<"\" as value"<<std::endl;
-							}else if(!(label.empty())){
-								auto iter_pend=pendingLabelMap.find(label);
-								if(iter_pend==pendingLabelMap.end()){
-									auto tmpPair=pendingLabelMap.insert(
-											std::pair<std::string,std::vector<std::pair<content_type,offset_type>>>(
-												label,
-												std::vector<std::pair<content_type,offset_type>>()
-											)
-									);
-									iter_pend=tmpPair.first;
-								}
-								iter_pend->second.push_back(std::pair<content_type,offset_type>(assembly.size()-1,offset));
-							}
-						}else{
-							assembly.push_back(PADD_NOOP);
-							assembly.push_back(PADD_NOOP);
-							(io.error())<<"failed to interpret \""<<arg1<<"\" as register"<<std::endl;
-						}
-					}break;
-					case INSTR_DATA:{
-						if(!(arg2.empty())){
-							//(io.warning())<<"ignoring unexpected extra argument \""<<arg2<<'"'<<std::endl;
-							arg1.append(arg2);
-						}
-						content_type immediate=0;
-						offset_type offset=0;
-						std::string label;
-						bool immGood=convert2Value_Expression(arg1,immediate,offset,label);
-						assembly.push_back(immediate);
-						if(!immGood){
-							(io.error())<<"failed to interpret \""<<arg1<<"\" as immediate value"<<std::endl;
-						}else if(!(label.empty())){
-							auto iter_pend=pendingLabelMap.find(label);
-							if(iter_pend==pendingLabelMap.end()){
-								auto tmpPair=pendingLabelMap.insert(
-										std::pair<std::string,std::vector<std::pair<content_type,offset_type>>>(
-											label,
-											std::vector<std::pair<content_type,offset_type>>()
-										)
-								);
-								iter_pend=tmpPair.first;
-							}
-							iter_pend->second.push_back(std::pair<content_type,offset_type>(assembly.size()-1,offset));
-						}
-					}break;
-					default:{
-						assembly.push_back(PADD_NOOP);
-						(io.error())<<"opcode handling unimplemented"<<std::endl;
-					}break;
-				}
-				isThisAddressLabelled=false;
+				return false;
 			}
 		}
-	}
-	if(isThisAddressLabelled){
-		(io.warning(IOManager::NoLineCount))<<"EOF reached; the last label is not labeling any defined content"<<std::endl;
+		return false;
 	}
 	
-	depth=constantMap.at(OPTION_DEPTH);
-	width=constantMap.at(OPTION_WIDTH);
-	bool isAddressNeedAdjustment=(constantMap.at(OPTION_IsByteAddressing)!=0);
-	bool isOffsetNeedAdjustment=isAddressNeedAdjustment&&(constantMap.at(OPTION_IsOffsetCorrectionNeeded));
+public:
+	BuildCache():isEnabled(false),finalOutput(nullptr){}
 	
-	//write mif file
-	unsigned address_width=1;
-	unsigned tmp_depth=depth;
-	while(tmp_depth>16){
-		++address_width;
-		tmp_depth>>=4;
-	}
-	unsigned data_width=(width-1)/4+1;
-	unsigned long long assembly_mask=(1<<width)-1;
-	if(assembly_mask==0){//when unsigned long long is not long enough
-		assembly_mask=-1;
-	}
-	if(assembly.size()>depth){
-		(io.warning(IOManager::NoLineCount))<<std::dec<<"size of assembly ("<<std::dec<<assembly.size()<<") is greater than depth ("<<depth<<") can store!"<<std::endl;
-		while(depth<assembly.size()) depth<<=1;
-		(io.info(IOManager::NoLineCount))<<"depth changed to "<<depth<<std::endl;
+	//return true if output and messages are taken from cache; otherwise source and output of io are redirected
+	bool replay(unsigned depth){
+		//listing, patch and statistics are not cached
+		if(runOptions.cacheDirectory.empty()||runOptions.isListing||(!(runOptions.deltaBaseFileName.empty()))||runOptions.isStatsShown) return false;
+		isEnabled=true;
+		std::ostringstream buf;
+		buf<<io.inputSrc->rdbuf();
+		
+		//everything affecting output other than files read by the source
+		std::ostringstream key;
+		key<<CACHE_MAGIC<<' '<<CACHE_VERSION<<' '<<__DATE__<<' '<<__TIME__<<'\n'
+				<<depth<<' '<<runOptions.isObjectOutput<<' '<<runOptions.isSymbolTableWritten<<' '<<runOptions.isaIndex<<'\n'
+				<<io.diagnosticFormat<<' '<<io.categoryLimit<<'\n'//stored messages are already formatted and capped
+				<<io.inputFileName<<'\n';
+		entryName=runOptions.cacheDirectory+'/'+toHex(hashBytes(buf.str(),hashBytes(key.str())))+".cache";
+		if(load()) return true;
+		
+		source.str(buf.str());
+		io.inputSrc=&source;
+		finalOutput=io.outputDest;
+		io.outputDest=&capturedOutput;
+		return false;
 	}
 	
-	//start to resolve labels
-	for(auto iter=pendingLabelMap.begin();iter!=pendingLabelMap.end();++iter){
-		auto iter_label=labelMap.find(iter->first);
-		if(iter_label==labelMap.end()){
-			std::ostream& errorDest=(io.error(IOManager::NoLineCount));
-			errorDest<<"when resolving labels: label \""<<iter->first<<"\" is not found\n\tNote: This label is evaluated at following (word) address:\n"<<std::hex;
-			for(auto iter_victim=iter->second.begin();iter_victim!=iter->second.end();++iter_victim){
-				errorDest<<"\t0x"<<(iter_victim->first);
-			}
-			errorDest<<std::endl;
-		}else{
-			content_type labelBaseAddress=iter_label->second;
-			if(isAddressNeedAdjustment) labelBaseAddress*=(width/8);
-			for(auto iter_eval=iter->second.begin();iter_eval!=iter->second.end();++iter_eval){
-				offset_type offset=iter_eval->second;
-				if(isOffsetNeedAdjustment) offset*=(width/8);
-				assembly[iter_eval->first]=labelBaseAddress+offset;
-				if(isAddressNeedAdjustment){
-					if(assembly[iter_eval->first]>=(depth*width/8)){
-						(io.warning(IOManager::NoLineCount))<<std::setfill('0')
-								<<"expression with label at (word) address 0x"<<std::hex<<std::nouppercase<<std::setw(address_width)<<iter_eval->first
-								<<" evaluates to (byte address) 0x"<<std::setw(data_width)<<assembly[iter_eval->first]<<std::dec
-								<<", which is not in address range of this memory (0 - 0x"<<std::setw(address_width)<<(depth*width/8)-1<<')'
-								<<std::dec<<std::endl;
-					}
-					if(offset%(width/8)!=0){
-						(io.warning(IOManager::NoLineCount))<<std::setfill('0')
-								<<"expression with label at (word) address 0x"<<std::hex<<std::nouppercase<<std::setw(address_width)<<iter_eval->first
-								<<" has unaligned offset ("<<offset<<')'<<std::endl;
-					}
-				}else{
-					if(assembly[iter_eval->first]>=depth){
-						(io.warning(IOManager::NoLineCount))<<std::setfill('0')
-								<<"expression with label at address 0x"<<std::hex<<std::nouppercase<<std::setw(address_width)<<iter_eval->first
-								<<" evaluates to 0x"<<std::setw(data_width)<<assembly[iter_eval->first]
-								<<", which is not in address range of this memory (0 - 0x"<<std::setw(address_width)<<depth-1<<')'
-								<<std::dec<<std::endl;
-					}
+	//write captured output to its destination and store the entry (before diagnostics are flushed)
+	void store(){
+		if(!isEnabled) return;
+		io.outputDest=finalOutput;
+		const std::string output=capturedOutput.str();
+		io.output().write(output.data(),output.length());
+		io.output().flush();
+		//bank images are separate files
+		if(banks.size()>1) return;
+		
+		std::ostringstream uniqueName;
+		uniqueName<<entryName<<'.'<<PROCESS_ID()<<'.'<<std::hash<std::thread::id>()(std::this_thread::get_id())
+				<<'.'<<std::chrono::steady_clock::now().time_since_epoch().count()<<".tmp";
+		const std::string tmpName=uniqueName.str();
+		{
+			std::ofstream dest(tmpName,std::ios::binary);
+			if(dest.good()){
+				const std::string diagnostics=io.saveDiagnostics();
+				dest<<CACHE_MAGIC<<' '<<CACHE_VERSION<<'\n';
+				for(auto iter_file=sourceFiles.begin();iter_file!=sourceFiles.end();++iter_file){
+					dest<<"FILE "<<hashFile(*iter_file)<<' '<<(*iter_file)<<'\n';
 				}
+				dest<<"OUTPUT "<<output.length()<<'\n';
+				dest.write(output.data(),output.length());
+				dest<<"\nDIAGNOSTICS "<<diagnostics.length()<<'\n';
+				dest.write(diagnostics.data(),diagnostics.length());
+			}
+			if(!(dest.good())){
+				dest.close();
+				std::remove(tmpName.c_str());
+				(io.warning("cache-write-failed",IOManager::NoLineCount))<<"failed to write build cache entry "<<tmpName<<std::endl;
+				return;
 			}
 		}
+		if(std::rename(tmpName.c_str(),entryName.c_str())!=0){
+			//another run may have stored the same entry (rename does not replace on Windows)
+			std::remove(tmpName.c_str());
+		}
 	}
-	std::ostream& outputDest=io.output();
-	
-	//output constants and labels
-#ifdef OUTPUT_WRITE_SYMBOL_TABLE
-	outputDest<<"-- Constants: "<<constantMap.size()<<" in total\n";
-	for(auto iter_tmp=constantMap.begin();iter_tmp!=constantMap.end();++iter_tmp){
-		outputDest<<"--\t"<<iter_tmp->first<<'\t'<<std::dec<<iter_tmp->second<<"\t0x"<<std::hex<<std::nouppercase<<iter_tmp->second<<'\n';
+};
+
+//place object files one after another, resolve labels across them and write mif
+int link(const std::vector<std::string>& objectFiles){
+	for(auto iter_option=optionVec.begin();iter_option!=optionVec.end();++iter_option){
+		constantMap.insert((*iter_option));
 	}
-	outputDest<<"-- Labels: "<<labelMap.size()<<" in total\n";
-	std::multimap<content_type,std::string> tmpLabelMap;//sort my increasing address
-	for(auto iter_tmp=labelMap.begin();iter_tmp!=labelMap.end();++iter_tmp){
-		tmpLabelMap.insert(std::pair<content_type,std::string>(iter_tmp->second,iter_tmp->first));
+	bool isAllLoaded=true;
+	for(std::size_t i=0;i<objectFiles.size();++i){
+		if(!(loadObject(objectFiles[i],i))) isAllLoaded=false;
 	}
-	for(auto iter_tmp=tmpLabelMap.begin();iter_tmp!=tmpLabelMap.end();++iter_tmp){
-		outputDest<<"--\t"<<iter_tmp->second<<"\t0x"<<std::hex<<std::nouppercase<<iter_tmp->first<<'\n';
+	if(!isAllLoaded){
+		//a mif without some of the modules is useless
+		(io.error("link-failed",IOManager::NoLineCount))<<"no output is written as some object files cannot be loaded"<<std::endl;
+		io.flushDiagnostics();
+		return 1;
 	}
-	outputDest<<'\n';
+	OutputFormat format=getOutputFormat();
+	resolveLabels(format);
+	writeMif(io.output(),format,assembly,comment_code,comment_label);
+	if(!(runOptions.deltaBaseFileName.empty())) writeDelta(format);
+	if(runOptions.isListing) writeListing(format);
+	if(runOptions.isStatsShown) reportStats();
+	io.flushDiagnostics();
+#ifdef INFO_SHOW_COUNTS
+	io.showCounts();
 #endif
+	return 0;
+}
 
-	outputDest<<"DEPTH = "<<depth
-			<<";\nWIDTH = "<<width
-			<<";\nADDRESS_RADIX = HEX;\nDATA_RADIX = HEX;\nCONTENT\nBEGIN\n";
-	
-	outputDest<<std::hex<<std::setfill('0')<<std::uppercase;
-	//bool isOversizeNotReported=true;
-	auto iter_labelComment=comment_label.begin();
-	for(std::size_t i=0;i<assembly.size();++i){
-		while((iter_labelComment!=comment_label.end())&&(iter_labelComment->second==i)){
-			outputDest<<"-- Label \""<<iter_labelComment->first<<"\":\n";
-			++iter_labelComment;
-		}
-		outputDest<<std::setw(address_width)<<i<<"\t:\t"<<std::setw(data_width)<<(assembly_mask&(assembly[i]))<<';';
-		if(!(comment_code[i].empty())){
-			outputDest<<"\t-- "<<comment_code[i];
-		}
-		outputDest<<'\n';
-	}
-#ifdef OUTPUT_ZERO_FILL
-	if((depth-assembly.size())==1){
-		outputDest<<std::setw(address_width)<<assembly.size()<<"\t:\t"<<std::setw(data_width)<<PADD_NOOP<<";\n";
-	}else if((depth-assembly.size())>1){
-		outputDest<<'['<<std::setw(address_width)<<assembly.size()<<".."<<std::setw(address_width)<<depth-1<<"]\t:\t"<<std::setw(data_width)<<PADD_NOOP<<";\n";
+//function that does main job
+int process(unsigned depth){
+	BuildCache cache;
+	if(cache.replay(depth)){
+		io.flushDiagnostics();
+#ifdef INFO_SHOW_COUNTS
+		io.showCounts();
+#endif
+		return 0;
 	}
+	std::unique_ptr<Pipeline> pipeline;
+	if(runOptions.isPipelined) pipeline.reset(new Pipeline());
+	assemble(depth);
+	if(runOptions.isObjectOutput){
+		writeObject(io.output());
+		if(runOptions.isStatsShown) reportStats();
+		pipeline.reset();
+		cache.store();
+		io.flushDiagnostics();
+#ifdef INFO_SHOW_COUNTS
+		io.showCounts();
 #endif
-	outputDest<<"END;"<<std::endl;
+		return 0;
+	}
+	OutputFormat format=getOutputFormat();
+	checkBankOverlap(format.depth);
+	resolveLabels(format);
+	{
+		BankWriters bankWriters;
+		bankWriters.start();
+		writeMif(io.output(),format,assembly,comment_code,comment_label);
+	}
+	//patch and listing are for the default bank only
+	if(!(runOptions.deltaBaseFileName.empty())) writeDelta(format);
+	if(runOptions.isListing) writeListing(format);
+	if(runOptions.isStatsShown) reportStats();
+	pipeline.reset();
+	cache.store();
+	io.flushDiagnostics();
 #ifdef INFO_SHOW_COUNTS
 	io.showCounts();
 #endif
 	return 0;
 }
 
+//replace suffix of fileName (if any) by the given one
+std::string getOutputFileName(std::string fileName, const std::string& suffix){
+	std::size_t nameStart=fileName.find_last_of("\\/");
+	std::size_t suffixStart=fileName.find_last_of('.');
+	if((suffixStart!=std::string::npos)&&//if there is something like a suffix
+			(!((nameStart!=std::string::npos)&&(suffixStart<nameStart)))//if it is really a suffix (not sth like ../src)
+			){
+		fileName.erase(suffixStart);
+	}
+	fileName.append(suffix);
+	return fileName;
+}
+
 int main(int argc, char** argv){
 	unsigned depth=128;
-	unsigned width=16;
 	bool isUsingFile=false;
 	std::string fileName;
 	
-	if(argc>1){
-		std::string arguments(argv[1]);
-		for(int i=2;i<argc;++i){
+	//options start with '-'; the rest are DEPTH, fileName or object files
+	std::vector<std::string> positionalArgs;
+	for(int i=1;i<argc;++i){
+		std::string arg(argv[i]);
+		if(arg==ARG_OBJECT){
+			runOptions.isObjectOutput=true;
+		}else if(arg==ARG_LINK){
+			runOptions.isLinking=true;
+		}else if(arg==ARG_OUTPUT){
+			if(i+1>=argc){
+				std::cerr<<"Error: "<<ARG_OUTPUT<<" requires a fileName"<<std::endl;
+				return 0;
+			}
+			runOptions.outputFileName=argv[++i];
+		}else if(arg==ARG_DISASSEMBLE){
+			runOptions.isDisassembling=true;
+		}else if(arg==ARG_SYMBOL){
+			if(i+1>=argc){
+				std::cerr<<"Error: "<<ARG_SYMBOL<<" requires a fileName"<<std::endl;
+				return 0;
+			}
+			runOptions.symbolFileName=argv[++i];
+		}else if(arg==ARG_LISTING){
+			runOptions.isListing=true;
+		}else if(arg==ARG_SYMBOL_TABLE){
+			runOptions.isSymbolTableWritten=true;
+		}else if(arg==ARG_PIPELINE){
+			runOptions.isPipelined=true;
+		}else if(arg==ARG_STATS){
+			runOptions.isStatsShown=true;
+		}else if(arg==ARG_CACHE){
+			if(i+1>=argc){
+				std::cerr<<"Error: "<<ARG_CACHE<<" requires a directory"<<std::endl;
+				return 0;
+			}
+			runOptions.cacheDirectory=argv[++i];
+		}else if(arg==ARG_ISA){
+			const std::string isaName=(i+1<argc)?getLowerCase(argv[++i]):std::string();
+			runOptions.isaIndex=ISA_COUNT;
+			for(std::size_t isaIndex=0;isaIndex<ISA_COUNT;++isaIndex){
+				if((isaName==ISA_TABLE[isaIndex].name)||(isaName==std::to_string(isaIndex))) runOptions.isaIndex=isaIndex;
+			}
+			if(runOptions.isaIndex==ISA_COUNT){
+				std::cerr<<"Error: "<<ARG_ISA<<" expects one of";
+				for(std::size_t isaIndex=0;isaIndex<ISA_COUNT;++isaIndex){
+					std::cerr<<' '<<ISA_TABLE[isaIndex].name;
+				}
+				std::cerr<<std::endl;
+				return 0;
+			}
+		}else if(arg==ARG_DELTA){
+			if(i+1>=argc){
+				std::cerr<<"Error: "<<ARG_DELTA<<" requires the fileName of previous image"<<std::endl;
+				return 0;
+			}
+			runOptions.deltaBaseFileName=argv[++i];
+		}else if(arg==ARG_DIAGNOSTIC_FORMAT){
+			std::string format=(i+1<argc)?getLowerCase(argv[++i]):std::string();
+			if(format=="text"){
+				io.diagnosticFormat=DIAGNOSTIC_FORMAT_TEXT;
+			}else if(format=="json"){
+				io.diagnosticFormat=DIAGNOSTIC_FORMAT_JSON;
+			}else if(format=="sarif"){
+				io.diagnosticFormat=DIAGNOSTIC_FORMAT_SARIF;
+			}else{
+				std::cerr<<"Error: "<<ARG_DIAGNOSTIC_FORMAT<<" expects text, json or sarif"<<std::endl;
+				return 0;
+			}
+		}else if(arg==ARG_DIAGNOSTIC_LIMIT){
+			std::stringstream buf((i+1<argc)?argv[++i]:"");
+			buf>>io.categoryLimit;
+			if(buf.fail()){
+				std::cerr<<"Error: "<<ARG_DIAGNOSTIC_LIMIT<<" expects a number"<<std::endl;
+				return 0;
+			}
+		}else if((arg.length()>1)&&(arg[0]=='-')){
+			std::cerr<<"Error: unknown option \""<<arg<<'"'<<std::endl;
+			return 0;
+		}else{
+			positionalArgs.push_back(arg);
+		}
+	}
+	
+	if(runOptions.isDisassembling){
+		if(positionalArgs.size()!=1){
+			std::cerr<<"Error: "<<ARG_DISASSEMBLE<<" expects exactly one mif file"<<std::endl;
+			return 0;
+		}
+		std::ofstream ofs;
+		if(!(runOptions.outputFileName.empty())){
+			ofs.open(runOptions.outputFileName);
+			if(!(ofs.good())){
+				std::cerr<<"Error: failed to write to "<<runOptions.outputFileName<<std::endl;
+				return 0;
+			}
+			io.outputDest=&ofs;
+		}
+		return disassemble(positionalArgs.front());
+	}
+	
+	if(runOptions.isLinking){
+		if(positionalArgs.empty()){
+			std::cerr<<"Error: no object file to link"<<std::endl;
+			return 0;
+		}
+		fileName=runOptions.outputFileName.empty()?getOutputFileName(positionalArgs.front(),".mif"):runOptions.outputFileName;
+		std::ofstream ofs(fileName);
+		if(!(ofs.good())){
+			std::cerr<<"Error: failed to write to "<<fileName<<std::endl;
+			return 0;
+		}
+		io.outputDest=&ofs;
+		runOptions.outputBaseName=getOutputFileName(fileName,"");
+		const int result=link(positionalArgs);
+		if(result!=0){
+			//do not leave an empty mif behind
+			ofs.close();
+			std::remove(fileName.c_str());
+		}
+		return result;
+	}
+	
+	if(!(positionalArgs.empty())){
+		std::string arguments(positionalArgs.front());
+		for(std::size_t i=1;i<positionalArgs.size();++i){
 			arguments.append(1,' ');
-			arguments.append(argv[i]);
+			arguments.append(positionalArgs[i]);
 		}
 		
 		std::stringstream args(arguments);
@@ -962,23 +4600,20 @@ int main(int argc, char** argv){
 		}
 	}
 	
+	const std::string outputSuffix=runOptions.isObjectOutput?".obj":".mif";
 	if(isUsingFile){
 		std::ifstream ifs(fileName);
 		if(ifs.good()){
+			const std::string sourceName=fileName;
 			//get output fileName
-			std::size_t nameStart=fileName.find_last_of("\\/");
-			std::size_t suffixStart=fileName.find_last_of('.');
-			if((suffixStart!=std::string::npos)&&//if there is something like a suffix
-					(!((nameStart!=std::string::npos)&&(suffixStart<nameStart)))//if it is really a suffix (not sth like ../src)
-					){
-				fileName.erase(suffixStart);
-			}
-			fileName.append(".mif");
+			fileName=runOptions.outputFileName.empty()?getOutputFileName(fileName,outputSuffix):runOptions.outputFileName;
+			runOptions.outputBaseName=getOutputFileName(fileName,"");
 			std::ofstream ofs(fileName);
 			if(ofs.good()){
 				io.inputSrc=&ifs;
+				io.inputFileName=sourceName;
 				io.outputDest=&ofs;
-				process(depth,width);
+				process(depth);
 				if(io.isPauseNeeded()){
 					ifs.close();
 					ofs.close();
@@ -995,7 +4630,17 @@ int main(int argc, char** argv){
 			std::cerr<<"Error: failed to read from "<<fileName<<std::endl;
 			return 0;
 		}
+	}else if(!(runOptions.outputFileName.empty())){
+		std::ofstream ofs(runOptions.outputFileName);
+		if(!(ofs.good())){
+			std::cerr<<"Error: failed to write to "<<runOptions.outputFileName<<std::endl;
+			return 0;
+		}
+		io.outputDest=&ofs;
+		runOptions.outputBaseName=getOutputFileName(runOptions.outputFileName,"");
+		return process(depth);
 	}else{
-		return process(depth,width);
+		runOptions.outputBaseName="output";
+		return process(depth);
 	}
-}
\ No newline at end of file
+}